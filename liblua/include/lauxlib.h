@@ -91,13 +91,15 @@ LUALIB_API const char *luaL_findtable (lua_State *L, int idx, const char *fname,
 
 typedef struct luaL_Buffer {
     char *p; /* current position in buffer */
-    int lvl; /* number of strings in the stack (level) */
+    int lvl; /* number of values in the stack (1 if the buffer is boxed) */
     lua_State *L;
-    char buffer[LUAL_BUFFERSIZE];
+    char *b; /* start of buffer */
+    size_t size; /* buffer size */
+    char buffer[LUAL_BUFFERSIZE]; /* initial buffer */
 } luaL_Buffer;
 
 #define luaL_addchar(B, c)                                                                                             \
-    ((void) ((B)->p < ((B)->buffer + LUAL_BUFFERSIZE) || luaL_prepbuffer(B)), (*(B)->p++ = (char) (c)))
+    ((void) ((B)->p < ((B)->b + (B)->size) || luaL_prepbuffsize(B, 1)), (*(B)->p++ = (char) (c)))
 
 /* compatibility only */
 #define luaL_putchar(B, c) luaL_addchar(B, c)
@@ -106,6 +108,7 @@ typedef struct luaL_Buffer {
 
 LUALIB_API void luaL_buffinit (lua_State *L, luaL_Buffer *B);
 LUALIB_API char *luaL_prepbuffer (luaL_Buffer *B);
+LUALIB_API char *luaL_prepbuffsize (luaL_Buffer *B, size_t sz);
 LUALIB_API void luaL_addlstring (luaL_Buffer *B, const char *s, size_t l);
 LUALIB_API void luaL_addstring (luaL_Buffer *B, const char *s);
 LUALIB_API void luaL_addvalue (luaL_Buffer *B);
@@ -102,6 +102,7 @@ LUA_API void lua_close (lua_State *L);
 LUA_API lua_State *lua_newthread (lua_State *L);
 
 LUA_API lua_CFunction lua_atpanic (lua_State *L, lua_CFunction panicf);
+LUA_API void lua_setnextfunction (lua_State *L, lua_CFunction nextf);
 
 /*
 ** basic stack manipulation
@@ -208,6 +209,8 @@ enum lua_GCOption {
     LUA_GCSTEP = 5,
     LUA_GCSETPAUSE = 6,
     LUA_GCSETSTEPMUL = 7,
+    LUA_GCSETFINBATCH = 8,
+    LUA_GCSETFINTIME = 9,
 };
 
 LUA_API int lua_gc (lua_State *L, int what, int dat);
@@ -219,11 +222,20 @@ LUA_API int lua_gc (lua_State *L, int what, int dat);
 LUA_API int lua_error (lua_State *L);
 
 LUA_API int lua_next (lua_State *L, int idx);
+LUA_API void lua_reservetable (lua_State *L, int idx, int narray, int nrec);
+LUA_API void lua_compacttable (lua_State *L, int idx);
+LUA_API void lua_clonetable (lua_State *L, int idx);
+LUA_API void lua_rawmove (lua_State *L, int idx, int f, int e, int d, int didx);
+LUA_API int lua_rawsort (lua_State *L, int idx, int n);
+LUA_API int lua_rawconcat (lua_State *L, int idx, int i, int j, const char *sep, size_t lsep);
+LUA_API void lua_wipe (lua_State *L, int idx);
 
 LUA_API void lua_concat (lua_State *L, int n);
+LUA_API void lua_join (lua_State *L, int n, const char *sep, size_t lsep);
 
 LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud);
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void *lua_realloc (lua_State *L, void *block, size_t osize, size_t nsize);
 
 /*
 ** ===============================================================
@@ -408,6 +420,7 @@ typedef int64_t lua_Clock;
 typedef struct lua_GlobalStats {
     size_t bytesused; /* total number of bytes in use */
     size_t bytesallocated; /* total number of bytes allocated */
+    size_t pendingfinalizers; /* number of userdata awaiting finalization */
 } lua_GlobalStats;
 
 typedef struct lua_SourceStats {
@@ -455,6 +468,9 @@ LUA_API void lua_setexceptmask (lua_State *L, int mask);
 LUA_API void lua_getscripttimeout (lua_State *L, lua_ScriptTimeout *timeout);
 LUA_API void lua_setscripttimeout (lua_State *L, const lua_ScriptTimeout *timeout);
 
+LUA_API size_t lua_getmemorylimit (lua_State *L);
+LUA_API void lua_setmemorylimit (lua_State *L, size_t limit);
+
 LUA_API int lua_ishookallowed (lua_State *L);
 
 /**
@@ -466,6 +482,8 @@ enum lua_CompatOption {
     LUA_COMPATGCTAINT, /* Invoke '__gc' metamethods without a taint barrier? (boolean) */
     LUA_COMPATGCDEBUG, /* Allow collection of debug info from '__gc' metamethods? (boolean) */
     LUA_COMPATINERRORHANDLER, /* Disable 'debuglocals' if called outside an error handler? (boolean) */
+    LUA_COMPATEPHEMERON, /* Collect weak-keyed entries only reachable through their own values? (boolean) */
+    LUA_COMPATSTRSPLIT, /* Use strings past embedded zeros in 'strsplit' and 'strjoin'? (boolean) */
 };
 
 LUA_API int lua_getcompatopt (lua_State *L, int opt);
@@ -129,6 +129,18 @@ LUA_API lua_CFunction lua_atpanic (lua_State *L, lua_CFunction panicf) {
     return old;
 }
 
+/*
+** Register `nextf' as a function that behaves exactly as `next' does: it
+** takes a table and a key, and returns the following key and value as
+** `lua_next' finds them. Generic `for' loops over a table that use it as
+** their generator step through the table without calling it.
+*/
+LUA_API void lua_setnextfunction (lua_State *L, lua_CFunction nextf) {
+    lua_lock(L);
+    G(L)->nextf = nextf;
+    lua_unlock(L);
+}
+
 LUA_API lua_State *lua_newthread (lua_State *L) {
     lua_State *L1;
     lua_lock(L);
@@ -515,13 +527,12 @@ LUA_API void lua_gettable (lua_State *L, int idx) {
 
 LUA_API void lua_getfield (lua_State *L, int idx, const char *k) {
     StkId tbl;
-    TValue key;
     lua_lock(L);
     tbl = index2adr(L, idx);
     api_checkvalidindex(L, tbl);
-    setsvalue(L, &key, luaS_new(L, k));
-    luaV_gettable(L, tbl, &key, L->top);
+    setsvalue2s(L, L->top, luaS_new(L, k)); /* anchor key on the stack */
     api_incr_top(L);
+    luaV_gettable(L, tbl, L->top - 1, L->top - 1);
     lua_unlock(L);
 }
 
@@ -549,10 +560,15 @@ LUA_API void lua_rawgeti (lua_State *L, int idx, int n) {
 }
 
 LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
+    Table *t;
     lua_lock(L);
     luaC_checkGC(L);
-    sethvalue(L, L->top, luaH_new(L, narray, nrec));
+    t = luaH_new(L);
+    sethvalue(L, L->top, t);
     api_incr_top(L);
+    if (narray > 0 || nrec > 0) {
+        luaH_resize(L, t, narray, nrec);
+    }
     lua_unlock(L);
 }
 
@@ -624,14 +640,14 @@ LUA_API void lua_settable (lua_State *L, int idx) {
 
 LUA_API void lua_setfield (lua_State *L, int idx, const char *k) {
     StkId tbl;
-    TValue key;
     lua_lock(L);
     api_checknelems(L, 1);
     tbl = index2adr(L, idx);
     api_checkvalidindex(L, tbl);
-    setsvalue(L, &key, luaS_new(L, k));
-    luaV_settable(L, tbl, &key, L->top - 1);
-    L->top--; /* pop value */
+    setsvalue2s(L, L->top, luaS_new(L, k)); /* anchor key on the stack */
+    L->top++; /* may use one of the extra slots */
+    luaV_settable(L, tbl, L->top - 1, L->top - 2);
+    L->top -= 2; /* pop value and key */
     lua_unlock(L);
 }
 
@@ -910,6 +926,16 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
             g->gcstepmul = data;
             break;
         }
+        case LUA_GCSETFINBATCH: {
+            res = g->gcfinbatch;
+            g->gcfinbatch = (data > 0) ? data : 1;
+            break;
+        }
+        case LUA_GCSETFINTIME: {
+            res = g->gcfintime;
+            g->gcfintime = (data > 0) ? data : 0;
+            break;
+        }
         default:
             res = -1; /* invalid option */
     }
@@ -944,6 +970,87 @@ LUA_API int lua_next (lua_State *L, int idx) {
     return more;
 }
 
+LUA_API void lua_reservetable (lua_State *L, int idx, int narray, int nrec) {
+    StkId t;
+    lua_lock(L);
+    luaC_checkGC(L);
+    t = index2adr(L, idx);
+    api_check(L, ttistable(t));
+    luaH_reserve(L, hvalue(t), narray, nrec);
+    lua_unlock(L);
+}
+
+LUA_API void lua_compacttable (lua_State *L, int idx) {
+    StkId t;
+    lua_lock(L);
+    t = index2adr(L, idx);
+    api_check(L, ttistable(t));
+    luaH_compact(L, hvalue(t));
+    lua_unlock(L);
+}
+
+LUA_API void lua_clonetable (lua_State *L, int idx) {
+    StkId o;
+    Table *t;
+    lua_lock(L);
+    luaC_checkGC(L);
+    o = index2adr(L, idx);
+    api_check(L, ttistable(o));
+    t = luaH_new(L);
+    sethvalue(L, L->top, t);
+    api_incr_top(L);
+    luaH_clone(L, t, hvalue(o));
+    lua_unlock(L);
+}
+
+LUA_API void lua_rawmove (lua_State *L, int idx, int f, int e, int d, int didx) {
+    StkId src;
+    StkId dst;
+    lua_lock(L);
+    src = index2adr(L, idx);
+    dst = index2adr(L, didx);
+    api_check(L, ttistable(src));
+    api_check(L, ttistable(dst));
+    luaH_move(L, hvalue(src), f, e, hvalue(dst), d);
+    lua_unlock(L);
+}
+
+LUA_API int lua_rawsort (lua_State *L, int idx, int n) {
+    StkId t;
+    int res;
+    lua_lock(L);
+    t = index2adr(L, idx);
+    api_check(L, ttistable(t));
+    res = luaH_sort(L, hvalue(t), n);
+    lua_unlock(L);
+    return res;
+}
+
+LUA_API int lua_rawconcat (lua_State *L, int idx, int i, int j, const char *sep, size_t lsep) {
+    StkId t;
+    TString *ts;
+    lua_lock(L);
+    t = index2adr(L, idx);
+    api_check(L, ttistable(t));
+    luaC_checkGC(L);
+    ts = luaH_concat(L, hvalue(t), i, j, sep, lsep);
+    if (ts != NULL) {
+        setsvalue2s(L, L->top, ts);
+        api_incr_top(L);
+    }
+    lua_unlock(L);
+    return (ts != NULL);
+}
+
+LUA_API void lua_wipe (lua_State *L, int idx) {
+    StkId t;
+    lua_lock(L);
+    t = index2adr(L, idx);
+    api_check(L, ttistable(t));
+    luaH_wipe(L, hvalue(t));
+    lua_unlock(L);
+}
+
 LUA_API void lua_concat (lua_State *L, int n) {
     lua_lock(L);
     api_checknelems(L, n);
@@ -959,6 +1066,20 @@ LUA_API void lua_concat (lua_State *L, int n) {
     lua_unlock(L);
 }
 
+LUA_API void lua_join (lua_State *L, int n, const char *sep, size_t lsep) {
+    lua_lock(L);
+    api_checknelems(L, n);
+    if (n >= 1) {
+        luaC_checkGC(L);
+        luaV_join(L, n, sep, lsep);
+        L->top -= (n - 1);
+    } else { /* push empty string */
+        setsvalue2s(L, L->top, luaS_newlstr(L, "", 0));
+        api_incr_top(L);
+    }
+    lua_unlock(L);
+}
+
 LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
     lua_Alloc f;
     lua_lock(L);
@@ -977,6 +1098,19 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
     lua_unlock(L);
 }
 
+/*
+** Resize `block' from `osize' to `nsize' bytes as the state allocates its
+** own objects: the block counts towards the memory in use and the memory
+** limit, and a failure raises a memory error after an emergency collection.
+*/
+LUA_API void *lua_realloc (lua_State *L, void *block, size_t osize, size_t nsize) {
+    void *p;
+    lua_lock(L);
+    p = luaM_realloc_(L, block, osize, nsize);
+    lua_unlock(L);
+    return p;
+}
+
 LUA_API void *lua_newuserdata (lua_State *L, size_t size) {
     Udata *u;
     lua_lock(L);
@@ -1256,10 +1390,11 @@ LUA_API void lua_setstacktaint (lua_State *L, const char *name) {
 }
 
 LUA_API void lua_setvaluetaint (lua_State *L, int idx, const char *name) {
-    StkId o = index2adr(L, idx);
-    api_checkvalidindex(L, o);
+    StkId o;
     lua_lock(L);
-    luaC_checkGC(L);
+    luaC_checkGC(L); /* may shrink the stack; look up `idx' afterwards */
+    o = index2adr(L, idx);
+    api_checkvalidindex(L, o);
     o->taint = newtaint(L, name);
     lua_unlock(L);
 }
@@ -1268,14 +1403,12 @@ LUA_API void lua_setobjecttaint (lua_State *L, int idx, const char *name) {
     StkId o;
 
     lua_lock(L);
+    luaC_checkGC(L); /* may shrink the stack; look up `idx' afterwards */
     o = index2adr(L, idx);
     api_checkvalidindex(L, o);
 
     if (iscollectable(o)) {
-        lua_lock(L);
-        luaC_checkGC(L);
         luaR_setobjecttaint(L, gcvalue(o), newtaint(L, name));
-        lua_unlock(L);
     }
 
     lua_unlock(L);
@@ -1511,6 +1644,7 @@ LUA_API void lua_setprofilingenabled (lua_State *L, int enable) {
         luaC_checkGC(L);
 
         /* Allocate closure statistics */
+        g->gcstopem++; /* collecting would invalidate the walk over 'rootgc' */
         for (o = g->rootgc; o != NULL; o = o->gch.next) {
             if (ttisfunction(&o->gch)) {
                 Closure *cl = gco2cl(o);
@@ -1520,6 +1654,7 @@ LUA_API void lua_setprofilingenabled (lua_State *L, int enable) {
                 }
             }
         }
+        g->gcstopem--;
     }
 
     g->enablestats = cast_byte(enable);
@@ -1536,6 +1671,7 @@ LUA_API void lua_collectstats (lua_State *L) {
     luaC_checkGC(L);
     resetsourcestats(g);
 
+    g->gcstopem++; /* collecting would invalidate the walk over 'rootgc' */
     for (o = g->rootgc; o != NULL; o = o->gch.next) {
         SourceStats *st = newsourcestats(g, o->gch.taint);
 
@@ -1549,6 +1685,7 @@ LUA_API void lua_collectstats (lua_State *L) {
             }
         }
     }
+    g->gcstopem--;
 
     lua_unlock(L);
 }
@@ -1566,6 +1703,7 @@ LUA_API void lua_getglobalstats (lua_State *L, lua_GlobalStats *stats) {
     g = G(L);
     stats->bytesused = g->totalbytes;
     stats->bytesallocated = g->bytesallocated;
+    stats->pendingfinalizers = g->tmudatacount;
     lua_unlock(L);
 }
 
@@ -1645,6 +1783,20 @@ LUA_API void lua_setscripttimeout (lua_State *L, const lua_ScriptTimeout *timeou
     lua_unlock(L);
 }
 
+LUA_API size_t lua_getmemorylimit (lua_State *L) {
+    size_t limit;
+    lua_lock(L);
+    limit = G(L)->memorylimit;
+    lua_unlock(L);
+    return limit;
+}
+
+LUA_API void lua_setmemorylimit (lua_State *L, size_t limit) {
+    lua_lock(L);
+    G(L)->memorylimit = limit;
+    lua_unlock(L);
+}
+
 LUA_API int lua_ishookallowed (lua_State *L) {
     return cast_int(L->allowhook);
 }
@@ -1659,7 +1811,10 @@ LUA_API int lua_getcompatopt (lua_State *L, int opt) {
         case LUA_COMPATGCTAINT:
         case LUA_COMPATGCDEBUG:
         case LUA_COMPATINERRORHANDLER:
+        case LUA_COMPATSTRSPLIT:
             return testbit(L->compatmask, opt) >> opt;
+        case LUA_COMPATEPHEMERON:
+            return G(L)->gcephemeron; /* shared by all threads */
         default:
             return 0;
     }
@@ -1671,8 +1826,12 @@ LUA_API void lua_setcompatopt (lua_State *L, int opt, int val) {
         case LUA_COMPATGCTAINT:
         case LUA_COMPATGCDEBUG:
         case LUA_COMPATINERRORHANDLER:
+        case LUA_COMPATSTRSPLIT:
             L->compatmask = cast_byte((L->compatmask & ~bitmask(opt)) | ((val & 0x1) << opt));
             return;
+        case LUA_COMPATEPHEMERON:
+            G(L)->gcephemeron = cast_byte(val & 0x1);
+            return;
         default:
             return;
     }
@@ -299,53 +299,87 @@ LUALIB_API const char *luaL_findtable (lua_State *L, int idx, const char *fname,
 ** =======================================================
 */
 
-#define bufflen(B) ((B)->p - (B)->buffer)
-#define bufffree(B) ((size_t) (LUAL_BUFFERSIZE - bufflen(B)))
+#define bufflen(B) ((size_t) ((B)->p - (B)->b))
+#define bufffree(B) ((B)->size - bufflen(B))
 
-#define LIMIT (LUA_MINSTACK / 2)
+/*
+** Contents that outgrow the initial buffer move into a heap block owned by a
+** userdata "box", which is the buffer's single value on the stack. The block
+** is resized in place with `lua_realloc', so it counts towards the memory of
+** the state, and the result is only interned once, by `luaL_pushresult'; the
+** box frees the block when it is collected.
+*/
 
-static int emptybuffer (luaL_Buffer *B) {
-    size_t l = bufflen(B);
-    if (l == 0) {
-        return 0; /* put nothing on stack */
-    } else {
-        lua_pushlstring(B->L, B->buffer, l);
-        B->p = B->buffer;
-        B->lvl++;
-        return 1;
+typedef struct UBox {
+    void *box;
+    size_t bsize;
+} UBox;
+
+static void *resizebox (lua_State *L, int idx, size_t newsize) {
+    UBox *box = (UBox *) lua_touserdata(L, idx);
+    void *temp = lua_realloc(L, box->box, box->bsize, newsize); /* box is unchanged on errors */
+    box->box = temp;
+    box->bsize = newsize;
+    return temp;
+}
+
+static int boxgc (lua_State *L) {
+    resizebox(L, 1, 0);
+    return 0;
+}
+
+static void *newbox (lua_State *L, size_t newsize) {
+    UBox *box = (UBox *) lua_newuserdata(L, sizeof(UBox));
+    box->box = NULL;
+    box->bsize = 0;
+    if (luaL_newmetatable(L, "_UBOX*")) { /* creating metatable? */
+        lua_pushcfunction(L, boxgc);
+        lua_setfield(L, -2, "__gc");
     }
+    lua_setmetatable(L, -2);
+    return resizebox(L, -1, newsize);
 }
 
-static void adjuststack (luaL_Buffer *B) {
-    if (B->lvl > 1) {
+/*
+** Make room for at least `sz' more bytes, at least doubling the buffer size
+** when it has to grow.
+*/
+LUALIB_API char *luaL_prepbuffsize (luaL_Buffer *B, size_t sz) {
+    if (bufffree(B) < sz) {
         lua_State *L = B->L;
-        int toget = 1; /* number of levels to concat */
-        size_t toplen = lua_strlen(L, -1);
-        do {
-            size_t l = lua_strlen(L, -(toget + 1));
-            if (B->lvl - toget + 1 >= LIMIT || toplen > l) {
-                toplen += l;
-                toget++;
-            } else {
-                break;
-            }
-        } while (toget < B->lvl);
-        lua_concat(L, toget);
-        B->lvl = B->lvl - toget + 1;
+        size_t l = bufflen(B);
+        size_t newsize = B->size * 2;
+        char *newbuff;
+        if (sz > ((size_t) -1) - l) {
+            luaL_error(L, "buffer too large");
+        }
+        if (newsize < l + sz) {
+            newsize = l + sz;
+        }
+        if (B->lvl) { /* already boxed? */
+            newbuff = (char *) resizebox(L, -1, newsize);
+        } else {
+            newbuff = (char *) newbox(L, newsize);
+            memcpy(newbuff, B->b, l);
+            B->lvl = 1;
+        }
+        B->b = newbuff;
+        B->p = newbuff + l;
+        B->size = newsize;
     }
+    return B->p;
 }
 
 LUALIB_API char *luaL_prepbuffer (luaL_Buffer *B) {
-    if (emptybuffer(B)) {
-        adjuststack(B);
-    }
-    return B->buffer;
+    return luaL_prepbuffsize(B, LUAL_BUFFERSIZE);
 }
 
 LUALIB_API void luaL_addlstring (luaL_Buffer *B, const char *s, size_t l) {
-    while (l--) {
-        luaL_addchar(B, *s++);
+    if (l > bufffree(B)) {
+        luaL_prepbuffsize(B, l);
     }
+    memcpy(B->p, s, l);
+    luaL_addsize(B, l);
 }
 
 LUALIB_API void luaL_addstring (luaL_Buffer *B, const char *s) {
@@ -353,8 +387,12 @@ LUALIB_API void luaL_addstring (luaL_Buffer *B, const char *s) {
 }
 
 LUALIB_API void luaL_pushresult (luaL_Buffer *B) {
-    emptybuffer(B);
-    lua_concat(B->L, B->lvl);
+    lua_State *L = B->L;
+    lua_pushlstring(L, B->b, bufflen(B));
+    if (B->lvl) {
+        resizebox(L, -2, 0); /* free the block now rather than at collection */
+        lua_remove(L, -2); /* remove box */
+    }
     B->lvl = 1;
 }
 
@@ -364,20 +402,22 @@ LUALIB_API void luaL_addvalue (luaL_Buffer *B) {
     const char *s = lua_tolstring(L, -1, &vl);
     if (vl <= bufffree(B)) { /* fit into buffer? */
         memcpy(B->p, s, vl); /* put it there */
-        B->p += vl;
+        luaL_addsize(B, vl);
         lua_pop(L, 1); /* remove from stack */
     } else {
-        if (emptybuffer(B)) {
-            lua_insert(L, -2); /* put buffer before new value */
+        if (B->lvl) {
+            lua_insert(L, -2); /* put value below box */
         }
-        B->lvl++; /* add new value into B stack */
-        adjuststack(B);
+        luaL_addlstring(B, s, vl); /* value stays anchored while it is copied */
+        lua_remove(L, -2); /* remove value; the buffer is now boxed */
     }
 }
 
 LUALIB_API void luaL_buffinit (lua_State *L, luaL_Buffer *B) {
     B->L = L;
+    B->b = B->buffer;
     B->p = B->buffer;
+    B->size = LUAL_BUFFERSIZE;
     B->lvl = 0;
 }
 
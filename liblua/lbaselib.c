@@ -797,6 +797,7 @@ static void baselib_openshared (lua_State *L) {
     lua_pushcclosure(L, luaB_ipairs, 1);
     lua_setfield(L, -2, "ipairs");
 
+    lua_setnextfunction(L, luaB_next);
     lua_pushcclosure(L, luaB_next, 0);
     lua_pushcclosure(L, luaB_pairs, 1);
     lua_setfield(L, -2, "pairs");
@@ -381,7 +381,8 @@ static int db_unref (lua_State *L) {
     return 0;
 }
 
-static const char *db_compatopts[] = { "setfenv", "gctaint", "gcdebug", "inerrorhandler", NULL };
+static const char *db_compatopts[] = { "setfenv",   "gctaint",  "gcdebug", "inerrorhandler",
+                                       "ephemeron", "strsplit", NULL };
 
 static int db_getcompatopt (lua_State *L) {
     lua_State *L1;
@@ -477,6 +478,22 @@ static int db_setscripttimeout (lua_State *L) {
     return 0;
 }
 
+static int db_getmemorylimit (lua_State *L) {
+    lua_pushnumber(L, (lua_Number) lua_getmemorylimit(L));
+    return 1;
+}
+
+static int db_setmemorylimit (lua_State *L) {
+    lua_Number limit = luaL_checknumber(L, 1);
+    luaL_argcheck(L, limit >= 0, 1, "limit must not be negative (0 for no limit)");
+    if (limit >= (lua_Number) ((size_t) -1)) { /* too large for size_t (or math.huge)? */
+        lua_setmemorylimit(L, (size_t) -1);
+    } else {
+        lua_setmemorylimit(L, (size_t) limit);
+    }
+    return 0;
+}
+
 static int db_debugprofilestart (lua_State *L) {
     lua_Clock *start = (lua_Clock *) lua_touserdata(L, lua_upvalueindex(1));
     *start = lua_clocktime(L);
@@ -762,6 +779,7 @@ static const luaL_Reg dblib_lua[] = {
     { "gethook", db_gethook },
     { "getinfo", db_getinfo },
     { "getlocal", db_getlocal },
+    { "getmemorylimit", db_getmemorylimit },
     { "getmetatable", db_getmetatable },
     { "getobjectsize", db_getobjectsize },
     { "getregistry", db_getregistry },
@@ -776,6 +794,7 @@ static const luaL_Reg dblib_lua[] = {
     { "setfenv", db_setfenv },
     { "sethook", db_sethook },
     { "setlocal", db_setlocal },
+    { "setmemorylimit", db_setmemorylimit },
     { "setmetatable", db_setmetatable },
     { "setscripttimeout", db_setscripttimeout },
     { "setupvalue", db_setupvalue },
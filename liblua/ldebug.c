@@ -175,12 +175,15 @@ static void collectvalidlines (lua_State *L, Closure *f) {
     if (f == NULL || f->c.isC) {
         setnilvalue(L, L->top);
     } else {
-        Table *t = luaH_new(L, 0, 0);
+        Table *t;
         int *lineinfo = f->l.p->lineinfo;
         int i;
+        G(L)->gcstopem++; /* neither `f' nor `t' need be anchored */
+        t = luaH_new(L);
         for (i = 0; i < f->l.p->sizelineinfo; i++) {
             setbvalue(L, luaH_setnum(L, t, lineinfo[i]), 1);
         }
+        G(L)->gcstopem--;
         sethvalue(L, L->top, t);
     }
     incr_top(L);
@@ -168,11 +168,15 @@ void luaD_throw (lua_State *L, int errcode) {
 
 int luaD_rawrunprotected (lua_State *L, Pfunc f, void *ud) {
     struct lua_longjmp lj;
+    lu_byte oldgcstopem = G(L)->gcstopem;
     lj.status = 0;
     lj.previous = L->errorJmp; /* chain new error handler */
     L->errorJmp = &lj;
     LUAI_TRY(L, &lj, (*f)(L, ud););
     L->errorJmp = lj.previous; /* restore old error handler */
+    if (lj.status != 0) {
+        G(L)->gcstopem = oldgcstopem; /* error may have left it raised */
+    }
     return lj.status;
 }
 
@@ -563,12 +567,13 @@ static void f_parser (lua_State *L, void *ud) {
     struct SParser *p = cast(struct SParser *, ud);
     luaC_checkGC(L);
     tf = luaY_parser(L, p->z, &p->buff, p->name);
+    setptvalue2s(L, L->top, tf); /* anchor prototype */
+    incr_top(L);
     cl = luaF_newLclosure(L, tf, hvalue(gt(L)));
+    setclvalue(L, L->top - 1, cl); /* replace prototype with its closure */
     for (i = 0; i < tf->nups; i++) { /* initialize eventual upvalues */
         cl->l.upvals[i] = luaF_newupval(L);
     }
-    setclvalue(L, L->top, cl);
-    incr_top(L);
 }
 
 int luaD_protectedparser (lua_State *L, ZIO *z, const char *name) {
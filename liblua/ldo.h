@@ -16,8 +16,8 @@
 
 #define incr_top(L)                                                                                                    \
     {                                                                                                                  \
-        luaD_checkstack(L, 1);                                                                                         \
         L->top++;                                                                                                      \
+        luaD_checkstack(L, 0);                                                                                         \
     }
 
 #define savestack(L, p) ((char *) (p) - (char *) L->stack)
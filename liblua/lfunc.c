@@ -23,14 +23,23 @@ ClosureStats *luaF_newclosurestats (lua_State *L) {
     return cs;
 }
 
+static void initstats (lua_State *L, Closure *c) {
+    c->c.stats = NULL;
+    if (G(L)->enablestats) {
+        G(L)->gcstopem++; /* closure is not anchored yet */
+        c->c.stats = luaF_newclosurestats(L);
+        G(L)->gcstopem--;
+    }
+}
+
 Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e) {
     Closure *c = cast(Closure *, luaM_malloc(L, sizeCclosure(nelems)));
     luaC_link(L, obj2gco(c), LUA_TFUNCTION);
     c->c.isC = 1;
     c->c.env = e;
-    c->c.stats = (G(L)->enablestats ? luaF_newclosurestats(L) : NULL);
     c->c.nupvalues = cast_byte(nelems);
     c->c.nopencalls = 0;
+    initstats(L, c);
     return c;
 }
 
@@ -41,12 +50,12 @@ Closure *luaF_newLclosure (lua_State *L, Proto *p, Table *e) {
     c->l.isC = 0;
     c->l.env = e;
     c->l.p = p;
-    c->l.stats = (G(L)->enablestats ? luaF_newclosurestats(L) : NULL);
     c->l.nupvalues = cast_byte(nelems);
     c->l.nopencalls = 0;
     while (nelems--) {
         c->l.upvals[nelems] = NULL;
     }
+    initstats(L, c);
     return c;
 }
 
@@ -124,6 +133,8 @@ Proto *luaF_newproto (lua_State *L) {
     luaC_link(L, obj2gco(f), LUA_TPROTO);
     f->k = NULL;
     f->sizek = 0;
+    f->khint = NULL;
+    f->sizekhint = 0;
     f->p = NULL;
     f->sizep = 0;
     f->code = NULL;
@@ -144,10 +155,23 @@ Proto *luaF_newproto (lua_State *L) {
     return f;
 }
 
+/*
+** Allocate the key hints of `f' once its constants are final.
+*/
+void luaF_newkhint (lua_State *L, Proto *f) {
+    int i;
+    f->khint = luaM_newvector(L, f->sizek, int);
+    f->sizekhint = f->sizek;
+    for (i = 0; i < f->sizekhint; i++) {
+        f->khint[i] = 0;
+    }
+}
+
 void luaF_freeproto (lua_State *L, Proto *f) {
     luaM_freearray(L, f->code, f->sizecode, Instruction);
     luaM_freearray(L, f->p, f->sizep, Proto *);
     luaM_freearray(L, f->k, f->sizek, TValue);
+    luaM_freearray(L, f->khint, f->sizekhint, int);
     luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
     luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
     luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
@@ -11,6 +11,7 @@
 #define sizeLclosure(n) (cast(int, sizeof(LClosure)) + cast(int, sizeof(TValue *) * ((n) -1)))
 
 LUAI_FUNC Proto *luaF_newproto (lua_State *L);
+LUAI_FUNC void luaF_newkhint (lua_State *L, Proto *f);
 LUAI_FUNC ClosureStats *luaF_newclosurestats (lua_State *L);
 LUAI_FUNC Closure *luaF_newCclosure (lua_State *L, int nelems, Table *e);
 LUAI_FUNC Closure *luaF_newLclosure (lua_State *L, Proto *p, Table *e);
@@ -145,6 +145,7 @@ size_t luaC_separateudata (lua_State *L, int all) {
                 g->tmudata->gch.next = curr;
                 g->tmudata = curr;
             }
+            g->tmudatacount++;
         }
     }
     return deadmem;
@@ -157,7 +158,7 @@ size_t luaC_objectsize (const GCObject *o) {
         }
         case LUA_TTABLE: {
             const Table *h = gco2h(o);
-            return sizeof(Table) + sizeof(TValue) * h->sizearray + sizeof(Node) * sizenode(h);
+            return sizeof(Table) + sizeof(TValue) * h->sizearray + nodebytes(sizenode(h));
         }
         case LUA_TFUNCTION: {
             const Closure *cl = gco2cl(o);
@@ -173,8 +174,8 @@ size_t luaC_objectsize (const GCObject *o) {
         case LUA_TPROTO: {
             const Proto *p = gco2p(o);
             return sizeof(Proto) + sizeof(Instruction) * p->sizecode + sizeof(Proto *) * p->sizep +
-                   sizeof(TValue) * p->sizek + sizeof(int) * p->sizelineinfo + sizeof(LocVar) * p->sizelocvars +
-                   sizeof(TString *) * p->sizeupvalues;
+                   sizeof(TValue) * p->sizek + sizeof(int) * p->sizekhint + sizeof(int) * p->sizelineinfo +
+                   sizeof(LocVar) * p->sizelocvars + sizeof(TString *) * p->sizeupvalues;
         }
         case LUA_TUPVAL: {
             return sizeof(UpVal);
@@ -186,6 +187,35 @@ size_t luaC_objectsize (const GCObject *o) {
     }
 }
 
+static int iscleared (const TValue *o, int iskey);
+
+/*
+** Traverse a table with weak keys and strong values, marking only the
+** values whose keys are already marked. Returns true if anything new was
+** marked, in which case other ephemerons may need another pass.
+*/
+static int traverseephemeron (global_State *g, Table *h) {
+    int marked = 0;
+    int i = h->sizearray;
+    while (i--) { /* array keys are never weak */
+        if (valiswhite(&h->array[i])) {
+            reallymarkobject(g, gcvalue(&h->array[i]));
+            marked = 1;
+        }
+    }
+    i = sizenode(h);
+    while (i--) {
+        Node *n = gnode(h, i);
+        if (ttisnil(gval(n))) {
+            removeentry(n); /* remove empty entries */
+        } else if (!iscleared(key2tval(n), 1) && valiswhite(gval(n))) {
+            reallymarkobject(g, gcvalue(gval(n)));
+            marked = 1;
+        }
+    }
+    return marked;
+}
+
 static int traversetable (global_State *g, Table *h) {
     int i;
     int weakkey = 0;
@@ -200,6 +230,12 @@ static int traversetable (global_State *g, Table *h) {
         if (weakkey || weakvalue) { /* is really weak? */
             h->marked &= ~(KEYWEAK | VALUEWEAK); /* clear bits */
             h->marked |= cast_byte((weakkey << KEYWEAKBIT) | (weakvalue << VALUEWEAKBIT));
+            if (weakkey && !weakvalue && g->gcephemeron) {
+                h->gclist = g->ephemeron; /* revisited until no more keys get marked */
+                g->ephemeron = obj2gco(h);
+                traverseephemeron(g, h);
+                return 1;
+            }
             h->gclist = g->weak; /* must be cleared after GC, ... */
             g->weak = obj2gco(h); /* ... so put in the appropriate list */
         }
@@ -266,8 +302,11 @@ static void traverseclosure (global_State *g, Closure *cl) {
         int i;
         lua_assert(cl->l.nupvalues == cl->l.p->nups);
         markobject(g, cl->l.p);
-        for (i = 0; i < cl->l.nupvalues; i++) /* mark its upvalues */
-            markobject(g, cl->l.upvals[i]);
+        for (i = 0; i < cl->l.nupvalues; i++) { /* mark its upvalues */
+            if (cl->l.upvals[i]) { /* may still be under construction */
+                markobject(g, cl->l.upvals[i]);
+            }
+        }
     }
 }
 
@@ -304,7 +343,9 @@ static void traversestack (global_State *g, lua_State *l) {
     for (; o <= lim; o++) {
         setnilvalue(l, o);
     }
-    checkstacksizes(l, lim);
+    if (!g->gcemergency) { /* stack may be in the middle of a reallocation */
+        checkstacksizes(l, lim);
+    }
 }
 
 /*
@@ -359,6 +400,26 @@ static size_t propagateall (global_State *g) {
     return m;
 }
 
+/*
+** Mark the values of ephemeron tables whose keys have become reachable,
+** repeating until no new objects are marked.
+*/
+static size_t convergeephemerons (global_State *g) {
+    size_t m = 0;
+    int changed;
+    do {
+        GCObject *l;
+        changed = 0;
+        for (l = g->ephemeron; l != NULL; l = gco2h(l)->gclist) {
+            if (traverseephemeron(g, gco2h(l))) {
+                m += propagateall(g);
+                changed = 1;
+            }
+        }
+    } while (changed);
+    return m;
+}
+
 /*
 ** The next function tells whether a key or value can be cleared from
 ** a weak table. Non-collectable objects are never removed from weak
@@ -390,6 +451,7 @@ static void cleartable (GCObject *l) {
                 TValue *o = &h->array[i];
                 if (iscleared(o, 0)) { /* value was collected? */
                     rawsetnilvalue(o); /* remove value */
+                    h->border = -1;
                 }
             }
         }
@@ -478,38 +540,56 @@ static void checkSizes (lua_State *L) {
     }
 }
 
-static void GCTM (lua_State *L) {
+/*
+** Call up to `n' pending GC tag methods, stopping early if the time
+** budget runs out. Hooks, threshold and taint are saved once for the
+** whole batch; returns the number of userdata finalized.
+*/
+static int GCTM (lua_State *L, int n) {
     global_State *g = G(L);
-    GCObject *o = g->tmudata->gch.next; /* get first element */
-    Udata *udata = rawgco2u(o);
-    const TValue *tm;
-    /* remove udata from `tmudata' */
-    if (o == g->tmudata) { /* last element? */
-        g->tmudata = NULL;
-    } else {
-        g->tmudata->gch.next = udata->uv.next;
-    }
-    udata->uv.next = g->mainthread->next; /* return it to `root' list */
-    g->mainthread->next = o;
-    makewhite(g, o);
-    tm = fasttm(L, udata->uv.metatable, TM_GC);
-    if (tm != NULL) {
-        struct TaintState savedts;
-        lu_byte oldah = L->allowhook;
-        size_t oldt = g->GCthreshold;
-        L->allowhook = 0; /* stop debug hooks during GC tag method */
-        g->GCthreshold = 2 * g->totalbytes; /* avoid GC steps */
-        luaR_savetaint(L, &savedts);
-        setobj2s(L, L->top, tm);
-        setuvalue(L, L->top + 1, udata);
-        L->top += 2;
-        luaD_call(L, L->top - 2, 0);
-        if (!testbit(L->compatmask, LUA_COMPATGCTAINT)) {
-            luaR_loadtaint(L, &savedts);
-        }
-        L->allowhook = oldah; /* restore hooks */
-        g->GCthreshold = oldt; /* restore threshold */
+    struct TaintState savedts;
+    lu_byte oldah = L->allowhook;
+    size_t oldt = g->GCthreshold;
+    lua_Clock deadline = 0;
+    int count = 0;
+    if (g->gcfintime > 0) {
+        deadline = luaG_clocktime(g) + (luaG_clockrate(g) * g->gcfintime) / 1000000;
+    }
+    L->allowhook = 0; /* stop debug hooks during GC tag methods */
+    luaR_savetaint(L, &savedts);
+    while (g->tmudata != NULL && count < n) {
+        GCObject *o = g->tmudata->gch.next; /* get first element */
+        Udata *udata = rawgco2u(o);
+        const TValue *tm;
+        /* remove udata from `tmudata' */
+        if (o == g->tmudata) { /* last element? */
+            g->tmudata = NULL;
+        } else {
+            g->tmudata->gch.next = udata->uv.next;
+        }
+        g->tmudatacount--;
+        udata->uv.next = g->mainthread->next; /* return it to `root' list */
+        g->mainthread->next = o;
+        makewhite(g, o);
+        count++;
+        tm = fasttm(L, udata->uv.metatable, TM_GC);
+        if (tm != NULL) {
+            g->GCthreshold = 2 * g->totalbytes; /* avoid GC steps */
+            setobj2s(L, L->top, tm);
+            setuvalue(L, L->top + 1, udata);
+            L->top += 2;
+            luaD_call(L, L->top - 2, 0);
+            if (!testbit(L->compatmask, LUA_COMPATGCTAINT)) {
+                luaR_loadtaint(L, &savedts); /* don't leak into the next finalizer */
+            }
+            if (deadline != 0 && luaG_clocktime(g) >= deadline) {
+                break;
+            }
+        }
     }
+    L->allowhook = oldah; /* restore hooks */
+    g->GCthreshold = oldt; /* restore threshold */
+    return count;
 }
 
 /*
@@ -517,7 +597,7 @@ static void GCTM (lua_State *L) {
 */
 void luaC_callGCTM (lua_State *L) {
     while (G(L)->tmudata) {
-        GCTM(L);
+        GCTM(L, LUA_INT_MAX);
     }
 }
 
@@ -529,6 +609,9 @@ void luaC_freeall (lua_State *L) {
     for (i = 0; i < g->strt.size; i++) { /* free all string lists */
         sweepwholelist(L, &g->strt.hash[i]);
     }
+    for (i = 0; i < g->strt.oldsize; i++) { /* ...including those not yet migrated */
+        sweepwholelist(L, &g->strt.oldhash[i]);
+    }
 }
 
 static void markmt (global_State *g) {
@@ -544,6 +627,7 @@ static void markroot (lua_State *L) {
     g->gray = NULL;
     g->grayagain = NULL;
     g->weak = NULL;
+    g->ephemeron = NULL;
     markobject(g, g->mainthread);
     /* make global table be traversed before main stack */
     markvalue(g, gt(g->mainthread));
@@ -576,14 +660,22 @@ static void atomic (lua_State *L) {
     markvalue(g, &g->l_errfunc); /* mark global error handler */
     markmt(g); /* mark basic metatables (again) */
     propagateall(g);
+    /* remark ephemeron tables */
+    g->gray = g->ephemeron;
+    g->ephemeron = NULL;
+    propagateall(g);
     /* remark gray again */
     g->gray = g->grayagain;
     g->grayagain = NULL;
     propagateall(g);
+    convergeephemerons(g);
     udsize = luaC_separateudata(L, 0); /* separate userdata to be finalized */
     marktmu(g); /* mark `preserved' userdata */
     udsize += propagateall(g); /* remark, to propagate `preserveness' */
+    udsize += convergeephemerons(g);
     cleartable(g->weak); /* remove collected objects from weak tables */
+    cleartable(g->ephemeron);
+    luaS_clearcache(g, 0); /* forget number strings about to be collected */
     /* flip current white */
     g->currentwhite = cast_byte(otherwhite(g));
     g->sweepstrgc = 0;
@@ -610,8 +702,11 @@ static ptrdiff_t singlestep (lua_State *L) {
         }
         case GCSsweepstring: {
             size_t old = g->totalbytes;
-            sweepwholelist(L, &g->strt.hash[g->sweepstrgc++]);
-            if (g->sweepstrgc >= g->strt.size) { /* nothing more to sweep? */
+            stringtable *tb = &g->strt;
+            int i = g->sweepstrgc++;
+            /* sweep current buckets, then any not yet migrated from `oldhash' */
+            sweepwholelist(L, (i < tb->size) ? &tb->hash[i] : &tb->oldhash[i - tb->size]);
+            if (g->sweepstrgc >= tb->size + tb->oldsize) { /* nothing more to sweep? */
                 g->gcstate = GCSsweep; /* end sweep-string phase */
             }
             lua_assert(old >= g->totalbytes);
@@ -621,21 +716,23 @@ static ptrdiff_t singlestep (lua_State *L) {
         case GCSsweep: {
             size_t old = g->totalbytes;
             g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
+            lua_assert(old >= g->totalbytes);
+            g->estimate -= old - g->totalbytes;
             if (*g->sweepgc == NULL) { /* nothing more to sweep? */
-                checkSizes(L);
+                if (!g->gcemergency) {
+                    checkSizes(L); /* may briefly hold both string tables */
+                }
                 g->gcstate = GCSfinalize; /* end sweep phase */
             }
-            lua_assert(old >= g->totalbytes);
-            g->estimate -= old - g->totalbytes;
             return GCSWEEPMAX * GCSWEEPCOST;
         }
         case GCSfinalize: {
-            if (g->tmudata) {
-                GCTM(L);
-                if (g->estimate > GCFINALIZECOST) {
-                    g->estimate -= GCFINALIZECOST;
+            if (g->tmudata && !g->gcemergency) {
+                ptrdiff_t cost = cast(ptrdiff_t, GCTM(L, g->gcfinbatch)) * GCFINALIZECOST;
+                if (g->estimate > cast(size_t, cost)) {
+                    g->estimate -= cost;
                 }
-                return GCFINALIZECOST;
+                return cost;
             } else {
                 g->gcstate = GCSpause; /* end collection */
                 g->gcdept = 0;
@@ -655,10 +752,12 @@ void luaC_step (lua_State *L) {
         lim = (LUA_PTRDIFF_MAX - 1) / 2; /* no limit */
     }
     g->gcdept += g->totalbytes - g->GCthreshold;
+    luaS_rehashstep(L, LUAI_STRREHASHSTEP);
     do {
+        int finalizing = (g->gcstate == GCSfinalize);
         lim -= singlestep(L);
-        if (g->gcstate == GCSpause) {
-            break;
+        if (g->gcstate == GCSpause || finalizing) {
+            break; /* at most one batch of finalizers per step */
         }
     } while (lim > 0);
     if (g->gcstate != GCSpause) {
@@ -675,7 +774,7 @@ void luaC_step (lua_State *L) {
 
 void luaC_fullgc (lua_State *L) {
     global_State *g = G(L);
-    if (g->gcstate <= GCSpropagate) {
+    if (g->gcstate == GCSpropagate) {
         /* reset sweep marks to sweep all elements (returning them to white) */
         g->sweepstrgc = 0;
         g->sweepgc = &g->rootgc;
@@ -683,21 +782,40 @@ void luaC_fullgc (lua_State *L) {
         g->gray = NULL;
         g->grayagain = NULL;
         g->weak = NULL;
+        g->ephemeron = NULL;
         g->gcstate = GCSsweepstring;
     }
-    lua_assert(g->gcstate != GCSpause && g->gcstate != GCSpropagate);
-    /* finish any pending sweep phase */
-    while (g->gcstate != GCSfinalize) {
+    lua_assert(g->gcstate != GCSpropagate);
+    /* finish any pending sweep phase; between cycles every object is already
+       white, so the pre-sweep can be skipped when starting from a pause */
+    while (g->gcstate != GCSfinalize && g->gcstate != GCSpause) {
         lua_assert(g->gcstate == GCSsweepstring || g->gcstate == GCSsweep);
         singlestep(L);
     }
     markroot(L);
+    propagateall(g); /* no mutator to interleave with; drain gray list at once */
     while (g->gcstate != GCSpause) {
         singlestep(L);
     }
     setthreshold(g);
 }
 
+/*
+** Collection requested by the allocator when memory runs short. This can
+** start from any allocation, so it skips anything that could reallocate or
+** run code: finalizers stay queued for the next regular cycle, and neither
+** the string table, the concatenation buffer, nor thread stacks are shrunk.
+*/
+void luaC_emergencygc (lua_State *L) {
+    global_State *g = G(L);
+    if (g->gcemergency || g->gcstopem || g->GCthreshold == cast(size_t, LUA_PTRDIFF_MAX)) {
+        return; /* already collecting, unsafe, or collector is stopped */
+    }
+    g->gcemergency = 1;
+    luaC_fullgc(L);
+    g->gcemergency = 0;
+}
+
 void luaC_barrierf (lua_State *L, GCObject *o, GCObject *v) {
     global_State *g = G(L);
     lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
@@ -95,11 +95,15 @@ void luaX_syntaxerror (LexState *ls, const char *msg) {
 TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     lua_State *L = ls->L;
     TString *ts = luaS_newlstr(L, str, l);
-    TValue *o = luaH_setstr(L, ls->fs->h, ts); /* entry for `str' */
+    TValue *o;
+    setsvalue2s(L, L->top, ts); /* anchor string while it is being inserted */
+    incr_top(L);
+    o = luaH_setstr(L, ls->fs->h, ts); /* entry for `str' */
     if (ttisnil(o)) {
         setbvalue(L, o, 1); /* make sure `str' will not be collected */
         luaC_checkGC(L);
     }
+    L->top--;
     return ts;
 }
 
@@ -38,6 +38,14 @@ typedef uint_least32_t Instruction;
 #define LUAI_MAXSTACK 250
 /* Minimum size for the string table (must be power of 2) */
 #define LUAI_MINSTRTABSIZE 32
+/* Number of old string table buckets migrated per incremental rehash step */
+#define LUAI_STRREHASHSTEP 8
+/* Partitions at or below this size are finished with an insertion sort */
+#define LUAI_SORTTHRESHOLD 16
+/* Concatenations at least this long are built in place, skipping the string buffer */
+#define LUAI_MINDIRECTCONCAT 1024
+/* Number of recent number to string conversions remembered (must be power of 2) */
+#define LUAI_NUMCACHESIZE 128
 /* Minimum size for string buffer */
 #define LUAI_MINBUFFER 32
 
@@ -10,6 +10,7 @@
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -57,16 +58,34 @@ void *luaM_toobig (lua_State *L) {
     luaG_runerror(L, "memory allocation error: block too big");
 }
 
+/* true if growing a block from `osize' to `nsize' would break the limit */
+#define exceedslimit(g, osize, nsize)                                                                                  \
+    ((g)->memorylimit != 0 && (nsize) > (osize) && ((g)->totalbytes - (osize)) + (nsize) > (g)->memorylimit)
+
 /*
 ** generic allocation routine.
 */
 void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
     global_State *g = G(L);
+    void *newblock;
     lua_assert((osize == 0) == (block == NULL));
-    block = (*g->frealloc)(g->ud, block, osize, nsize);
-    if (block == NULL && nsize > 0) {
-        luaD_throw(L, LUA_ERRMEM);
+    if (exceedslimit(g, osize, nsize)) {
+        luaC_emergencygc(L); /* try to free some memory... */
+        if (exceedslimit(g, osize, nsize)) {
+            luaD_throw(L, LUA_ERRMEM); /* ...but still over the limit */
+        }
+    }
+    newblock = (*g->frealloc)(g->ud, block, osize, nsize);
+    if (newblock == NULL && nsize > 0) {
+        if (nsize > osize) {
+            luaC_emergencygc(L); /* try to free some memory... */
+            newblock = (*g->frealloc)(g->ud, block, osize, nsize); /* ...and try again */
+        }
+        if (newblock == NULL) {
+            luaD_throw(L, LUA_ERRMEM);
+        }
     }
+    block = newblock;
     lua_assert((nsize == 0) == (block == NULL));
     g->totalbytes = (g->totalbytes - osize) + nsize;
     if (nsize > osize) {
@@ -109,6 +109,136 @@ int luaO_str2d (const char *s, lua_Number *result) {
     return 1;
 }
 
+#if defined(__SIZEOF_INT128__)
+
+/* powers of ten up to the most scaling `luaO_num2str' tries */
+static const unsigned long long pow10tab[] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+};
+
+/* `m' / 2^`shift' scaled by 10^`k', rounded to nearest even */
+static __uint128_t scaledround (unsigned long long m, int shift, int k) {
+    __uint128_t n = cast(__uint128_t, m) * pow10tab[k];
+    __uint128_t q = n >> shift;
+    __uint128_t rem = n - (q << shift);
+    __uint128_t half = cast(__uint128_t, 1) << (shift - 1);
+    if (rem > half || (rem == half && (q & 1) != 0)) {
+        q++;
+    }
+    return q;
+}
+
+#endif
+
+static char *writedigits (char *end, unsigned long long u) {
+    do {
+        *--end = cast(char, '0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    return end;
+}
+
+/*
+** Convert `n' as `lua_number2str' does, returning the length of the result.
+** Values that "%.14g" prints without an exponent are converted exactly in
+** integer arithmetic: the mantissa is scaled by the power of ten that
+** leaves 14 significant digits, and divided by its binary exponent with
+** ties rounded to even, as `printf' rounds. Other values and platforms
+** without 128-bit integers use `lua_number2str'.
+*/
+int luaO_num2str (char *s, lua_Number n) {
+#if defined(__SIZEOF_INT128__)
+    char buff[LUAI_MAXNUMBER2STR];
+    char *end = buff + sizeof(buff);
+    char *p = end;
+    unsigned long long bits;
+    unsigned long long m;
+    int shift;
+    lua_assert(sizeof(n) == sizeof(bits));
+    memcpy(&bits, &n, sizeof(bits));
+    m = bits & ((1ull << 52) - 1);
+    shift = cast_int((bits >> 52) & 0x7ff);
+    if (shift == 0 && m == 0) {
+        p = writedigits(end, 0);
+    } else if (shift != 0 && shift < 1075) {
+        m |= 1ull << 52; /* normal and below 2^52 */
+        shift = 1075 - shift; /* n = m / 2^shift, 0 < shift < 2^11 */
+        if (shift <= 52 && (m & ((1ull << shift) - 1)) == 0) {
+            unsigned long long u = m >> shift; /* integral */
+            if (u < pow10tab[14]) {
+                p = writedigits(end, u);
+            }
+        } else {
+            int e2 = 52 - shift; /* floor(log2(|n|)) */
+            int e = (e2 >= 0) ? (e2 * 78913) >> 18 : -((-e2 * 78913 + 262143) >> 18);
+            int tries;
+            for (tries = 0; tries < 3; tries++) { /* `e' is at most one too low */
+                int k = 13 - e; /* fractional digits for 14 significant */
+                __uint128_t q;
+                if (k < 0 || k > 18) {
+                    break;
+                }
+                q = scaledround(m, shift, k);
+                if (q >= pow10tab[14]) {
+                    e++;
+                } else if (q < pow10tab[13]) {
+                    e--;
+                } else {
+                    unsigned long long u = cast(unsigned long long, q);
+                    unsigned long long f = u % pow10tab[k];
+                    if (k == 18) {
+                        break; /* exponent below -4; "%g" uses scientific */
+                    }
+                    while (k > 0 && f % 10 == 0) { /* "%g" drops trailing zeros */
+                        f /= 10;
+                        k--;
+                    }
+                    if (k > 0) {
+                        p = writedigits(end, f);
+                        while (end - p < k) {
+                            *--p = '0';
+                        }
+                        *--p = '.';
+                    }
+                    p = writedigits(p, u / pow10tab[13 - e]);
+                    break;
+                }
+            }
+        }
+    }
+    if (p != end) {
+        int l;
+        if (bits >> 63) {
+            *--p = '-'; /* includes -0 */
+        }
+        l = cast_int(end - p);
+        memcpy(s, p, l);
+        s[l] = '\0';
+        return l;
+    }
+#endif
+    lua_number2str(s, n);
+    return cast_int(strlen(s));
+}
+
 static void pushstr (lua_State *L, const char *str) {
     setsvalue2s(L, L->top, luaS_new(L, str));
     incr_top(L);
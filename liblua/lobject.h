@@ -139,6 +139,7 @@ typedef union Udata {
 typedef struct Proto {
     CommonHeader;
     TValue *k; /* constants used by the function */
+    int *khint; /* node hints for the string constants used as keys */
     Instruction *code;
     struct Proto **p; /* functions defined inside the function */
     int *lineinfo; /* map from opcodes to source lines */
@@ -147,6 +148,7 @@ typedef struct Proto {
     TString *source;
     int sizeupvalues;
     int sizek; /* size of `k' */
+    int sizekhint; /* size of `khint' */
     int sizecode;
     int sizelineinfo;
     int sizep; /* size of `p' */
@@ -233,7 +235,9 @@ typedef union Closure {
 typedef union TKey {
     struct {
         TValuefields;
+#if !defined(LUA_USE_SWISSTABLE)
         struct Node *next; /* for chaining */
+#endif
     } nk;
     TValue tvk;
 } TKey;
@@ -250,9 +254,15 @@ typedef struct Table {
     struct Table *metatable;
     TValue *array; /* array part */
     Node *node;
+#if defined(LUA_USE_SWISSTABLE)
+    int nodefree; /* number of free nodes that may still take a key */
+#else
     Node *lastfree; /* any free position is before this position */
+#endif
     GCObject *gclist;
     int sizearray; /* size of `array' array */
+    int border; /* border of a gapless array part, or -1 if unknown */
+    int cursor; /* node of the last key returned by `next' */
 } Table;
 
 /*
@@ -274,6 +284,7 @@ LUAI_FUNC int luaO_int2fb (unsigned int x);
 LUAI_FUNC int luaO_fb2int (int x);
 LUAI_FUNC int luaO_rawequalObj (const TValue *t1, const TValue *t2);
 LUAI_FUNC int luaO_str2d (const char *s, lua_Number *result);
+LUAI_FUNC int luaO_num2str (char *s, lua_Number n);
 LUAI_FUNC const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp);
 LUAI_FUNC const char *luaO_pushfstring (lua_State *L, const char *fmt, ...);
 LUAI_FUNC void luaO_chunkid (char *out, const char *source, size_t len);
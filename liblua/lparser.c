@@ -297,11 +297,14 @@ static void pushclosure (LexState *ls, FuncState *func, expdesc *v) {
     Proto *f = fs->f;
     int oldsize = f->sizep;
     int i;
+    setptvalue2s(ls->L, ls->L->top, func->f); /* anchor closed prototype */
+    incr_top(ls->L);
     luaM_growvector(ls->L, f->p, fs->np, f->sizep, Proto *, MAXARG_Bx, "constant table overflow");
     while (oldsize < f->sizep) {
         f->p[oldsize++] = NULL;
     }
     f->p[fs->np++] = func->f;
+    ls->L->top--;
     luaC_objbarrier(ls->L, f, func->f);
     init_exp(v, VRELOCABLE, luaK_codeABx(fs, OP_CLOSURE, 0, fs->np - 1));
     for (i = 0; i < func->f->nups; i++) {
@@ -329,12 +332,12 @@ static void open_func (LexState *ls, FuncState *fs) {
     fs->bl = NULL;
     f->source = ls->source;
     f->maxstacksize = 2; /* registers 0/1 are always valid */
-    fs->h = luaH_new(L, 0, 0);
-    /* anchor table of constants and prototype (to avoid being collected) */
-    sethvalue2s(L, L->top, fs->h);
-    incr_top(L);
+    /* anchor prototype and table of constants (to avoid being collected) */
     setptvalue2s(L, L->top, f);
     incr_top(L);
+    fs->h = luaH_new(L);
+    sethvalue2s(L, L->top, fs->h);
+    incr_top(L);
 }
 
 static void close_func (LexState *ls) {
@@ -349,6 +352,7 @@ static void close_func (LexState *ls) {
     f->sizelineinfo = fs->pc;
     luaM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
     f->sizek = fs->nk;
+    luaF_newkhint(L, f);
     luaM_reallocvector(L, f->p, f->sizep, fs->np, Proto *);
     f->sizep = fs->np;
     luaM_reallocvector(L, f->locvars, f->sizelocvars, fs->nlocvars, LocVar);
@@ -368,14 +372,18 @@ static void close_func (LexState *ls) {
 Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff, const char *name) {
     struct LexState lexstate;
     struct FuncState funcstate;
+    TString *source = luaS_new(L, name);
+    setsvalue2s(L, L->top, source); /* anchor chunk name */
+    incr_top(L);
     lexstate.buff = buff;
-    luaX_setinput(L, &lexstate, z, luaS_new(L, name));
+    luaX_setinput(L, &lexstate, z, source);
     open_func(&lexstate, &funcstate);
     funcstate.f->is_vararg = VARARG_ISVARARG; /* main func. is always vararg */
     luaX_next(&lexstate); /* read first token */
     chunk(&lexstate);
     check(&lexstate, TK_EOS);
     close_func(&lexstate);
+    L->top--; /* remove chunk name */
     lua_assert(funcstate.prev == NULL);
     lua_assert(funcstate.f->nups == 0);
     lua_assert(lexstate.fs == NULL);
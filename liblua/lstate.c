@@ -2,6 +2,8 @@
  * in the "LICENSE" file or at <http://www.lua.org/license.html> */
 
 #include <stddef.h>
+#include <string.h>
+#include <time.h>
 
 #define lstate_c
 #define LUA_CORE
@@ -32,6 +34,32 @@ typedef struct LG {
     global_State g;
 } LG;
 
+#if defined(LUA_USE_FULLSTRINGHASH)
+
+/*
+** Create a seed for string hashes from the addresses of the new state and
+** of a local variable, and from the current time, so that collisions cannot
+** be prepared in advance.
+*/
+#define addbuff(b, p, e)                                                                                               \
+    {                                                                                                                  \
+        size_t t_ = cast(size_t, e);                                                                                   \
+        memcpy((b) + (p), &t_, sizeof(t_));                                                                            \
+        (p) += sizeof(t_);                                                                                             \
+    }
+
+static unsigned int makeseed (lua_State *L) {
+    char buff[3 * sizeof(size_t)];
+    unsigned int h = cast(unsigned int, time(NULL));
+    size_t p = 0;
+    addbuff(buff, p, L);
+    addbuff(buff, p, &h);
+    addbuff(buff, p, luaO_nilobject);
+    return luaS_hash(buff, p, h);
+}
+
+#endif
+
 static void stack_init (lua_State *L1, lua_State *L) {
     /* initialize CallInfo array */
     L1->base_ci = luaM_newvector(L, BASIC_CI_SIZE, CallInfo);
@@ -60,8 +88,9 @@ static void freestack (lua_State *L, lua_State *L1) {
 ** Create registry table and its predefined values
 */
 static void init_registry (lua_State *L, global_State *g) {
-    Table *registry = luaH_new(L, LUA_RIDX_LAST, 0);
+    Table *registry = luaH_new(L);
     sethvalue(L, &g->l_registry, registry);
+    luaH_resize(L, registry, LUA_RIDX_LAST, 0);
     setthvalue(L, luaH_setnum(L, registry, LUA_RIDX_MAINTHREAD), L);
     setbvalue(L, luaH_setnum(L, registry, LUA_RIDX_INERRORHANDLER), 0);
 }
@@ -73,7 +102,8 @@ static void f_luaopen (lua_State *L, void *ud) {
     global_State *g = G(L);
     lua_unused(ud);
     stack_init(L, L); /* init stack */
-    sethvalue(L, gt(L), luaH_new(L, 0, 2)); /* table of globals */
+    sethvalue(L, gt(L), luaH_new(L)); /* table of globals */
+    luaH_resize(L, hvalue(gt(L)), 0, 2);
     init_registry(L, g);
     luaS_resize(L, LUAI_MINSTRTABSIZE); /* initial size of string table */
     luaT_init(L);
@@ -82,6 +112,7 @@ static void f_luaopen (lua_State *L, void *ud) {
     luaS_fix(luaS_newliteral(L, LUA_FORCEINSECURE_TAINT));
     luaS_fix(luaS_newliteral(L, LUA_LOADSTRING_TAINT));
     g->GCthreshold = 4 * g->totalbytes;
+    g->gcstopem = 0;
 }
 
 static void preinit_state (lua_State *L, global_State *g) {
@@ -133,6 +164,7 @@ static void close_state (lua_State *L) {
     freesourcestats(g);
     lua_assert(g->sourcestats == NULL);
     luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size, TString *);
+    luaM_freearray(L, G(L)->strt.oldhash, G(L)->strt.oldsize, TString *);
     luaZ_freebuffer(L, &g->buff);
     freestack(L, L);
     lua_assert(g->totalbytes == sizeof(LG));
@@ -143,7 +175,9 @@ lua_State *luaE_newthread (lua_State *L) {
     lua_State *L1 = tostate(luaM_malloc(L, state_size(lua_State)));
     luaC_link(L, obj2gco(L1), LUA_TTHREAD);
     preinit_state(L1, G(L));
+    G(L)->gcstopem++; /* thread is not traversable until its stack exists */
     stack_init(L1, L); /* init stack */
+    G(L)->gcstopem--;
     setobj2n(L, gt(L1), gt(L)); /* share table of globals */
     L1->compatmask = L->compatmask;
     L1->exceptmask = L->exceptmask;
@@ -193,10 +227,18 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
     g->strt.size = 0;
     g->strt.nuse = 0;
     g->strt.hash = NULL;
+    g->strt.oldhash = NULL;
+    g->strt.oldsize = 0;
+    g->strt.rehashpos = 0;
+#if defined(LUA_USE_FULLSTRINGHASH)
+    g->seed = makeseed(L);
+#endif
     setnilvalue(L, registry(L));
     setnilvalue(L, &g->l_errfunc);
     luaZ_initbuffer(L, &g->buff);
+    luaS_clearcache(g, 1);
     g->panic = NULL;
+    g->nextf = NULL;
     g->gcstate = GCSpause;
     g->rootgc = obj2gco(L);
     g->sweepstrgc = 0;
@@ -204,13 +246,21 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
     g->gray = NULL;
     g->grayagain = NULL;
     g->weak = NULL;
+    g->ephemeron = NULL;
     g->tmudata = NULL;
+    g->tmudatacount = 0;
     g->totalbytes = sizeof(LG);
     g->gcpause = LUAI_GCPAUSE;
     g->gcstepmul = LUAI_GCMUL;
+    g->gcfinbatch = LUAI_GCFINBATCH;
+    g->gcfintime = LUAI_GCFINTIME;
     g->gcdept = 0;
     luaG_init(g);
     g->bytesallocated = g->totalbytes;
+    g->memorylimit = 0;
+    g->gcemergency = 0;
+    g->gcstopem = 1; /* no emergency collections until the state is built */
+    g->gcephemeron = 0;
     g->sourcestats = NULL;
     for (i = 0; i < NUM_TAGS; i++) {
         g->mt[i] = NULL;
@@ -29,6 +29,9 @@ typedef struct stringtable {
     GCObject **hash;
     uint_least32_t nuse; /* number of elements */
     int size;
+    GCObject **oldhash; /* previous `hash' still being migrated (or NULL) */
+    int oldsize;
+    int rehashpos; /* next bucket of `oldhash' to migrate */
 } stringtable;
 
 /*
@@ -66,6 +69,9 @@ typedef struct SourceStats {
 */
 typedef struct global_State {
     stringtable strt; /* hash table for strings */
+#if defined(LUA_USE_FULLSTRINGHASH)
+    unsigned int seed; /* randomized seed for string hashes */
+#endif
     lua_Alloc frealloc; /* function to reallocate memory */
     void *ud; /* auxiliary data to `frealloc' */
     lu_byte enablestats;
@@ -77,19 +83,30 @@ typedef struct global_State {
     GCObject *gray; /* list of gray objects */
     GCObject *grayagain; /* list of objects to be traversed atomically */
     GCObject *weak; /* list of weak tables (to be cleared) */
+    GCObject *ephemeron; /* list of ephemeron tables (weak keys, to be cleared) */
     GCObject *tmudata; /* last element of list of userdata to be GC */
     Mbuffer buff; /* temporary buffer for string concatentation */
+    lua_Number numcachekey[LUAI_NUMCACHESIZE]; /* numbers converted by `luaS_fromnumber' */
+    TString *numcache[LUAI_NUMCACHESIZE]; /* their strings (NULL if unused) */
     size_t GCthreshold;
     size_t totalbytes; /* number of bytes currently allocated */
     size_t estimate; /* an estimate of number of bytes actually in use */
     size_t gcdept; /* how much GC is `behind schedule' */
     int gcpause; /* size of pause between successive GCs */
     int gcstepmul; /* GC `granularity' */
+    int gcfinbatch; /* maximum number of finalizers run per step */
+    int gcfintime; /* finalizer time budget per step in microseconds (0 if unlimited) */
+    size_t tmudatacount; /* number of elements in `tmudata' */
     lua_Clock startticks; /* tick count at startup */
     lua_Clock tickfreq; /* tick frequency; cached on startup */
     size_t bytesallocated; /* total number of bytes allocated */
+    size_t memorylimit; /* maximum value of `totalbytes' (0 if unlimited) */
+    lu_byte gcemergency; /* true if an emergency collection is running */
+    lu_byte gcstopem; /* non-zero while emergency collections are unsafe */
+    lu_byte gcephemeron; /* treat weak-keyed tables as ephemerons? */
     SourceStats *sourcestats; /* list of source-specific statistics */
     lua_CFunction panic; /* to be called in unprotected errors */
+    lua_CFunction nextf; /* `next' function that generic for loops may inline */
     TValue l_registry;
     TValue l_errfunc; /* global error handler */
     struct lua_State *mainthread;
@@ -61,6 +61,8 @@ static int statslib_getglobalstats (lua_State *L) {
     lua_setfield(L, -2, "bytesused");
     lua_pushnumber(L, (lua_Number) stats.bytesallocated);
     lua_setfield(L, -2, "bytesallocated");
+    lua_pushnumber(L, (lua_Number) stats.pendingfinalizers);
+    lua_setfield(L, -2, "pendingfinalizers");
 
     return 1;
 }
@@ -14,6 +14,13 @@
 #include "lstate.h"
 #include "lstring.h"
 
+/*
+** Resizing the string table does not rehash every string at once. The current
+** table becomes `oldhash', and its buckets are migrated into the new table a
+** few at a time by `luaS_rehashstep' as strings are created and the collector
+** runs; until then lookups search both tables. Migration is suspended while
+** the collector sweeps strings, as that phase walks both tables by index.
+*/
 void luaS_resize (lua_State *L, int newsize) {
     GCObject **newhash;
     stringtable *tb;
@@ -21,74 +28,310 @@ void luaS_resize (lua_State *L, int newsize) {
     if (G(L)->gcstate == GCSsweepstring) {
         return; /* cannot resize during GC traverse */
     }
-    newhash = luaM_newvector(L, newsize, GCObject *);
     tb = &G(L)->strt;
+    if (tb->oldhash != NULL) {
+        return; /* previous resize is still being migrated */
+    }
+    newhash = luaM_newvector(L, newsize, GCObject *);
     for (i = 0; i < newsize; i++) {
         newhash[i] = NULL;
     }
-    /* rehash */
-    for (i = 0; i < tb->size; i++) {
-        GCObject *p = tb->hash[i];
+    tb->oldhash = tb->hash;
+    tb->oldsize = tb->size;
+    tb->rehashpos = 0;
+    tb->hash = newhash;
+    tb->size = newsize;
+    luaS_rehashstep(L, LUAI_STRREHASHSTEP);
+}
+
+void luaS_rehashstep (lua_State *L, int n) {
+    stringtable *tb = &G(L)->strt;
+    if (tb->oldhash == NULL || G(L)->gcstate == GCSsweepstring) {
+        return; /* nothing to migrate, or sweep is walking both tables */
+    }
+    for (; n > 0 && tb->rehashpos < tb->oldsize; n--) {
+        GCObject *p = tb->oldhash[tb->rehashpos];
+        tb->oldhash[tb->rehashpos++] = NULL;
         while (p) { /* for each node in the list */
             GCObject *next = p->gch.next; /* save next */
             unsigned int h = gco2ts(p)->hash;
-            int h1 = lmod(h, newsize); /* new position */
-            lua_assert(cast_int(h % newsize) == lmod(h, newsize));
-            p->gch.next = newhash[h1]; /* chain it */
-            newhash[h1] = p;
+            int h1 = lmod(h, tb->size); /* new position */
+            lua_assert(cast_int(h % tb->size) == lmod(h, tb->size));
+            p->gch.next = tb->hash[h1]; /* chain it */
+            tb->hash[h1] = p;
             p = next;
         }
     }
-    luaM_freearray(L, tb->hash, tb->size, TString *);
-    tb->size = newsize;
-    tb->hash = newhash;
+    if (tb->rehashpos >= tb->oldsize) { /* migration complete? */
+        luaM_freearray(L, tb->oldhash, tb->oldsize, TString *);
+        tb->oldhash = NULL;
+        tb->oldsize = 0;
+        tb->rehashpos = 0;
+    }
 }
 
-static TString *newlstr (lua_State *L, const char *str, size_t l, unsigned int h) {
-    TString *ts;
-    stringtable *tb;
+#if defined(LUA_USE_FULLSTRINGHASH)
+
+/*
+** Full-content hash in the style of wyhash. Every byte of the string is
+** hashed; strings longer than 48 bytes are consumed in three independent
+** 16-byte lanes per round.
+*/
+
+#define HASHP0 UINT64_C(0xa0761d6478bd642f)
+#define HASHP1 UINT64_C(0xe7037ed1a0b428db)
+#define HASHP2 UINT64_C(0x8ebc6af09c88c6e3)
+#define HASHP3 UINT64_C(0x589965cc75374cc3)
+
+static uint64_t read64 (const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read32 (const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* folded 64x64->128 bit product of `a' and `b' */
+static uint64_t hashmix (uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = cast(__uint128_t, a) * b;
+    return cast(uint64_t, r) ^ cast(uint64_t, r >> 64);
+#else
+    uint64_t ha = a >> 32, la = cast(uint32_t, a);
+    uint64_t hb = b >> 32, lb = cast(uint32_t, b);
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    return lo ^ hi;
+#endif
+}
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+    const unsigned char *p = cast(const unsigned char *, str);
+    uint64_t s = hashmix(seed ^ HASHP0, HASHP1);
+    uint64_t a;
+    uint64_t b;
+    if (l <= 16) {
+        if (l >= 4) {
+            size_t d = (l >> 3) << 2; /* 0 or 4 */
+            a = (read32(p) << 32) | read32(p + d);
+            b = (read32(p + l - 4) << 32) | read32(p + l - 4 - d);
+        } else if (l > 0) {
+            a = (cast(uint64_t, p[0]) << 16) | (cast(uint64_t, p[l >> 1]) << 8) | p[l - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = l;
+        if (i > 48) {
+            uint64_t s1 = s;
+            uint64_t s2 = s;
+            do {
+                s = hashmix(read64(p) ^ HASHP1, read64(p + 8) ^ s);
+                s1 = hashmix(read64(p + 16) ^ HASHP2, read64(p + 24) ^ s1);
+                s2 = hashmix(read64(p + 32) ^ HASHP3, read64(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            s ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            s = hashmix(read64(p) ^ HASHP1, read64(p + 8) ^ s);
+            p += 16;
+            i -= 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    return cast(unsigned int, hashmix(hashmix(a ^ HASHP1, b ^ s) ^ HASHP0 ^ l, HASHP1 ^ s));
+}
+
+#else
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+    unsigned int h = seed ^ cast(unsigned int, l);
+    size_t step = (l >> 5) + 1; /* if string is too long, don't hash all its chars */
+    size_t l1;
+    for (l1 = l; l1 >= step; l1 -= step) { /* compute hash */
+        h = h ^ ((h << 5) + (h >> 2) + cast(unsigned char, str[l1 - 1]));
+    }
+    return h;
+}
+
+#endif
+
+/*
+** Allocate an unlinked string of length `l', growing the string table first
+** if it is too crowded.
+*/
+static TString *allocstr (lua_State *L, size_t l) {
+    stringtable *tb = &G(L)->strt;
     if (l + 1 > (LUA_SIZE_MAX - sizeof(TString)) / sizeof(char)) {
         luaM_toobig(L);
     }
-    ts = cast(TString *, luaM_malloc(L, (l + 1) * sizeof(char) + sizeof(TString)));
+    if (tb->nuse >= cast(uint_least32_t, tb->size) && tb->size <= LUA_INT_MAX / 2) {
+        luaS_resize(L, tb->size * 2); /* too crowded; grow before `ts' exists */
+    } else {
+        luaS_rehashstep(L, LUAI_STRREHASHSTEP);
+    }
+    return cast(TString *, luaM_malloc(L, (l + 1) * sizeof(char) + sizeof(TString)));
+}
+
+/*
+** Link the string `ts' allocated by `allocstr', whose contents are already
+** in place, into the string table.
+*/
+static TString *linkstr (lua_State *L, TString *ts, size_t l, unsigned int h) {
+    stringtable *tb = &G(L)->strt;
     ts->tsv.len = l;
     ts->tsv.hash = h;
     ts->tsv.marked = luaC_white(G(L));
     ts->tsv.tt = LUA_TSTRING;
     ts->tsv.reserved = 0;
     luaR_taintalloc(L, obj2gco(ts));
-    memcpy(ts + 1, str, l * sizeof(char));
     ((char *) (ts + 1))[l] = '\0'; /* ending 0 */
-    tb = &G(L)->strt;
     h = lmod(h, tb->size);
     ts->tsv.next = tb->hash[h]; /* chain new entry */
     tb->hash[h] = obj2gco(ts);
     tb->nuse++;
-    if (tb->nuse > cast(uint_least32_t, tb->size) && tb->size <= LUA_INT_MAX / 2) {
-        luaS_resize(L, tb->size * 2); /* too crowded */
-    }
     return ts;
 }
 
-TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
-    GCObject *o;
-    unsigned int h = cast(unsigned int, l); /* seed */
-    size_t step = (l >> 5) + 1; /* if string is too long, don't hash all its chars */
-    size_t l1;
-    for (l1 = l; l1 >= step; l1 -= step) { /* compute hash */
-        h = h ^ ((h << 5) + (h >> 2) + cast(unsigned char, str[l1 - 1]));
-    }
-    for (o = G(L)->strt.hash[lmod(h, G(L)->strt.size)]; o != NULL; o = o->gch.next) {
+static TString *newlstr (lua_State *L, const char *str, size_t l, unsigned int h) {
+    TString *ts = allocstr(L, l);
+    memcpy(ts + 1, str, l * sizeof(char));
+    return linkstr(L, ts, l, h);
+}
+
+static TString *findstr (global_State *g, GCObject *o, const char *str, size_t l) {
+    for (; o != NULL; o = o->gch.next) {
         TString *ts = rawgco2ts(o);
         if (ts->tsv.len == l && (memcmp(str, getstr(ts), l) == 0)) {
             /* string may be dead */
-            if (isdead(G(L), o)) {
+            if (isdead(g, o)) {
                 changewhite(o);
             }
             return ts;
         }
     }
-    return newlstr(L, str, l, h); /* not found */
+    return NULL;
+}
+
+TString *luaS_newlstr (lua_State *L, const char *str, size_t l) {
+    stringtable *tb;
+    TString *ts;
+    unsigned int h = luaS_hash(str, l, luaS_seed(G(L)));
+    tb = &G(L)->strt;
+    ts = findstr(G(L), tb->hash[lmod(h, tb->size)], str, l);
+    if (ts == NULL && tb->oldhash != NULL) { /* bucket may not be migrated yet */
+        ts = findstr(G(L), tb->oldhash[lmod(h, tb->oldsize)], str, l);
+    }
+    return (ts != NULL) ? ts : newlstr(L, str, l, h); /* create if not found */
+}
+
+/*
+** Allocate a string of length `l' that is not interned yet, for the caller to
+** fill in before passing it to `luaS_intern'. Nothing may raise an error or
+** allocate in between, as the string is unknown to the collector until then.
+*/
+TString *luaS_prepare (lua_State *L, size_t l) {
+    TString *ts = allocstr(L, l);
+    ts->tsv.len = l;
+    return ts;
+}
+
+/*
+** Intern the string `ts' from `luaS_prepare', whose contents are now in
+** place. If an equal string already exists, `ts' is freed and that string
+** is returned instead.
+*/
+TString *luaS_intern (lua_State *L, TString *ts) {
+    stringtable *tb = &G(L)->strt;
+    const char *str = getstr(ts);
+    size_t l = ts->tsv.len;
+    unsigned int h = luaS_hash(str, l, luaS_seed(G(L)));
+    TString *old = findstr(G(L), tb->hash[lmod(h, tb->size)], str, l);
+    if (old == NULL && tb->oldhash != NULL) { /* bucket may not be migrated yet */
+        old = findstr(G(L), tb->oldhash[lmod(h, tb->oldsize)], str, l);
+    }
+    if (old != NULL) {
+        luaM_freemem(L, ts, (l + 1) * sizeof(char) + sizeof(TString));
+        return old;
+    }
+    return linkstr(L, ts, l, h);
+}
+
+/*
+** Create the string formed by the `n' strings from `o', of total length
+** `l'. The parts are copied once, straight into the new string.
+*/
+TString *luaS_newconcat (lua_State *L, const TValue *o, int n, size_t l) {
+    TString *ts = luaS_prepare(L, l);
+    char *buff = cast(char *, ts + 1);
+    size_t tl = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        size_t pl = tsvalue(o + i)->len;
+        memcpy(buff + tl, svalue(o + i), pl * sizeof(char));
+        tl += pl;
+    }
+    lua_assert(tl == l);
+    return luaS_intern(L, ts);
+}
+
+/*
+** Slot of the number to string cache for the number `n'. Numbers are told
+** apart by their bits, so that -0 and NaNs of either sign keep their own
+** strings.
+*/
+static unsigned int numslot (lua_Number n) {
+    unsigned int a[sizeof(lua_Number) / sizeof(unsigned int)];
+    unsigned int h = 0;
+    size_t i;
+    memcpy(a, &n, sizeof(a));
+    for (i = 0; i < sizeof(a) / sizeof(a[0]); i++) {
+        h = (h ^ a[i]) * 0x9e3779b1u;
+    }
+    return (h ^ (h >> 16)) & (LUAI_NUMCACHESIZE - 1);
+}
+
+/*
+** Return the string for the number `n', as `luaO_num2str' converts it. The
+** strings of recent conversions are remembered in a direct-mapped cache, so
+** that converting the same numbers again neither formats nor hashes them.
+*/
+TString *luaS_fromnumber (lua_State *L, lua_Number n) {
+    global_State *g = G(L);
+    unsigned int i = numslot(n);
+    TString *ts = g->numcache[i];
+    if (ts == NULL || memcmp(&g->numcachekey[i], &n, sizeof(n)) != 0) {
+        char s[LUAI_MAXNUMBER2STR];
+        int l = luaO_num2str(s, n);
+        ts = luaS_newlstr(L, s, l);
+        g->numcachekey[i] = n;
+        g->numcache[i] = ts;
+    }
+    return ts;
+}
+
+/*
+** Forget the cached number strings, or only those that the collector has
+** not marked. This is called in the atomic phase, before strings are swept,
+** so the cache never refers to a collected string.
+*/
+void luaS_clearcache (global_State *g, int all) {
+    int i;
+    for (i = 0; i < LUAI_NUMCACHESIZE; i++) {
+        if (g->numcache[i] != NULL && (all || iswhite(obj2gco(g->numcache[i])))) {
+            g->numcache[i] = NULL;
+        }
+    }
 }
 
 Udata *luaS_newudata (lua_State *L, size_t s, Table *e) {
@@ -17,8 +17,21 @@
 
 #define luaS_fix(s) l_setbit((s)->tsv.marked, FIXEDBIT)
 
+#if defined(LUA_USE_FULLSTRINGHASH)
+#define luaS_seed(g) ((g)->seed)
+#else
+#define luaS_seed(g) 0
+#endif
+
+LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_rehashstep (lua_State *L, int n);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s, Table *e);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_prepare (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_intern (lua_State *L, TString *ts);
+LUAI_FUNC TString *luaS_newconcat (lua_State *L, const TValue *o, int n, size_t l);
+LUAI_FUNC TString *luaS_fromnumber (lua_State *L, lua_Number n);
+LUAI_FUNC void luaS_clearcache (global_State *g, int all);
 
 #endif
@@ -2,6 +2,7 @@
  * in the "LICENSE" file or at <http://www.lua.org/license.html> */
 
 #include <ctype.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +17,14 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LUAI_SCANSSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LUAI_SCANNEON
+#endif
+
 /* macro to `unsign' a character */
 #define uchar(c) ((unsigned char) (c))
 
@@ -176,6 +185,7 @@ typedef struct MatchState {
     const char *src_init; /* init of source string */
     const char *src_end; /* end (`\0') of source string */
     lua_State *L;
+    const struct PatProg *prog; /* compiled pattern, or NULL to interpret */
     int level; /* total number of captures (finished or unfinished) */
     struct {
         const char *init;
@@ -494,6 +504,119 @@ init: /* using goto's to optimize tail recursion */
     }
 }
 
+/*
+** Two-Way string matching (Crochemore and Perrin), which finds `n' within
+** `h' in linear time and constant space. The needle is split at a critical
+** factorization; the right part is compared first and shifts are taken
+** from the last byte of the window as in Boyer-Moore-Horspool.
+*/
+static const char *twowayfind (const unsigned char *h, size_t hl, const unsigned char *n, size_t l) {
+    const unsigned char *z = h + hl;
+    size_t byteset[(UCHAR_MAX + 1) / (CHAR_BIT * sizeof(size_t))];
+    size_t shift[UCHAR_MAX + 1];
+    size_t i, ip, jp, k, p, ms, p0, mem, mem0;
+    memset(byteset, 0, sizeof(byteset));
+    for (i = 0; i < l; i++) { /* fill the shift table */
+        byteset[n[i] / (CHAR_BIT * sizeof(size_t))] |= (size_t) 1 << (n[i] % (CHAR_BIT * sizeof(size_t)));
+        shift[n[i]] = i + 1;
+    }
+    /* compute the maximal suffix */
+    ip = (size_t) -1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] > n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+    /* and with the opposite comparison */
+    ip = (size_t) -1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] < n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    if (ip + 1 > ms + 1) {
+        ms = ip;
+    } else {
+        p = p0;
+    }
+    if (memcmp(n, n + p, ms + 1) != 0) { /* not periodic? */
+        mem0 = 0;
+        p = ((ms > l - ms - 1) ? ms : l - ms - 1) + 1;
+    } else {
+        mem0 = l - p;
+    }
+    mem = 0;
+    while ((size_t) (z - h) >= l) {
+        unsigned char last = h[l - 1];
+        if (byteset[last / (CHAR_BIT * sizeof(size_t))] & ((size_t) 1 << (last % (CHAR_BIT * sizeof(size_t))))) {
+            k = l - shift[last];
+            if (k != 0) {
+                h += (k < mem) ? mem : k;
+                mem = 0;
+                continue;
+            }
+        } else {
+            h += l;
+            mem = 0;
+            continue;
+        }
+        /* compare the right part */
+        for (k = (ms + 1 > mem) ? ms + 1 : mem; k < l && n[k] == h[k]; k++) {
+        }
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+        /* compare the left part */
+        for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--) {
+        }
+        if (k <= mem) {
+            return (const char *) h;
+        }
+        h += p;
+        mem = mem0;
+    }
+    return NULL;
+}
+
+/*
+** Candidates found by `memchr' are checked with `memcmp' until more than one
+** in every MEMFINDDENSITY bytes has failed, in which case the search goes on
+** with `twowayfind' to avoid quadratic behaviour on repetitive text.
+*/
+#define MEMFINDDENSITY 32
+
 static const char *lmemfind (const char *s1, size_t l1, const char *s2, size_t l2) {
     if (l2 == 0) {
         return s1; /* empty strings are everywhere */
@@ -501,6 +624,8 @@ static const char *lmemfind (const char *s1, size_t l1, const char *s2, size_t l
         return NULL; /* avoids a negative `l1' */
     } else {
         const char *init; /* to search for a `*s2' inside `s1' */
+        const char *start = s1;
+        size_t misses = 0;
         l2--; /* 1st char will be checked by `memchr' */
         l1 = l1 - l2; /* `s2' cannot be found after that */
         while (l1 > 0 && (init = (const char *) memchr(s1, *s2, l1)) != NULL) {
@@ -511,11 +636,591 @@ static const char *lmemfind (const char *s1, size_t l1, const char *s2, size_t l
                 l1 -= init - s1;
                 s1 = init;
             }
+            if (l2 > 1 && ++misses > (size_t) (s1 - start) / MEMFINDDENSITY + 4) {
+                return twowayfind((const unsigned char *) s1, l1 + l2, (const unsigned char *) s2, l2 + 1);
+            }
         }
         return NULL; /* not found */
     }
 }
 
+/*
+** {======================================================
+** Compiled patterns
+** =======================================================
+*/
+
+/*
+** A compiled pattern is a sequence of items that mirrors the dispatch done
+** by `match', so that matching never calls `classend' and tests bracket
+** classes against a bitmap. Patterns that `classend', `%b' or `%f' would
+** reject are not compiled; they run through `match' so that their errors
+** are raised only when reached, as before. Character classes such as `%a'
+** follow the current locale and so are still tested with `match_class'.
+*/
+
+enum PatKind {
+    PK_END, /* end of pattern */
+    PK_ENDANCHOR, /* `$' at the end of the pattern */
+    PK_OPEN, /* `(' */
+    PK_POSITION, /* `()' */
+    PK_CLOSE, /* `)' */
+    PK_BALANCE, /* `%bxy' */
+    PK_FRONTIER, /* `%f[set]' */
+    PK_BACKREF, /* `%1' to `%9' */
+    PK_LITERAL, /* run of characters that each match once */
+    PK_ANY, /* `.' */
+    PK_CHAR, /* single character */
+    PK_CLASS, /* `%a' and friends */
+    PK_SET /* `[set]' */
+};
+
+typedef struct PatItem {
+    unsigned char kind;
+    unsigned char rep; /* `?', `*', `+', `-', or 0 to match once */
+    char c[2]; /* character, class, capture index, or balance delimiters */
+    int arg; /* offset of a literal run, or index of a set */
+    int len; /* length of a literal run */
+} PatItem;
+
+typedef struct PatSet {
+    unsigned char bits[UCHAR_MAX / CHAR_BIT + 1]; /* characters and ranges */
+    unsigned int classes; /* classes from `PATCLASSES'; upper case from bit 10 */
+    int sig; /* 0 if the set is complemented */
+} PatSet;
+
+typedef struct PatProg {
+    PatItem *items;
+    PatSet *sets;
+    char *lit; /* characters of literal runs */
+    int first; /* character every match starts with, or -1 */
+    int firstitem; /* item that every match starts with, or -1 */
+    int prefixlen; /* length of the literal run every match starts with */
+    const char *prefix;
+} PatProg;
+
+static const char PATCLASSES[] = "acdlpsuwxz";
+
+#define setbit(set, c) ((set)->bits[(c) / CHAR_BIT] |= (unsigned char) (1u << ((c) % CHAR_BIT)))
+#define testbit(set, c) ((set)->bits[(c) / CHAR_BIT] & (1u << ((c) % CHAR_BIT)))
+
+static int setmatch (const PatSet *set, int c) {
+    if (testbit(set, c)) {
+        return set->sig;
+    } else if (set->classes != 0) {
+        unsigned int m;
+        int i;
+        for (i = 0, m = set->classes; m != 0; i++, m >>= 1) {
+            if ((m & 1) && match_class(c, (i < 10) ? PATCLASSES[i] : toupper(PATCLASSES[i - 10]))) {
+                return set->sig;
+            }
+        }
+    }
+    return !set->sig;
+}
+
+static void compileclass (PatSet *set, int cl) {
+    const char *k = (cl != 0) ? strchr(PATCLASSES, tolower(cl)) : NULL;
+    if (k == NULL) {
+        setbit(set, cl); /* `match_class' compares it as a plain character */
+    } else {
+        set->classes |= 1u << ((k - PATCLASSES) + (islower(cl) ? 0 : 10));
+    }
+}
+
+/* same walk as `matchbracketclass' */
+static void compileset (PatSet *set, const char *p, const char *ec) {
+    memset(set->bits, 0, sizeof(set->bits));
+    set->classes = 0;
+    set->sig = 1;
+    if (*(p + 1) == '^') {
+        set->sig = 0;
+        p++; /* skip the `^' */
+    }
+    while (++p < ec) {
+        if (*p == L_ESC) {
+            p++;
+            compileclass(set, uchar(*p));
+        } else if ((*(p + 1) == '-') && (p + 2 < ec)) {
+            int c;
+            p += 2;
+            for (c = uchar(*(p - 2)); c <= uchar(*p); c++) {
+                setbit(set, c);
+            }
+        } else {
+            setbit(set, uchar(*p));
+        }
+    }
+}
+
+/* `classend' that returns NULL rather than raising an error */
+static const char *compileclassend (const char *p) {
+    switch (*p++) {
+        case L_ESC: {
+            return (*p == '\0') ? NULL : p + 1;
+        }
+        case '[': {
+            if (*p == '^') {
+                p++;
+            }
+            do { /* look for a `]' */
+                if (*p == '\0') {
+                    return NULL;
+                }
+                if (*(p++) == L_ESC && *p != '\0') {
+                    p++; /* skip escapes (e.g. `%]') */
+                }
+            } while (*p != ']');
+            return p + 1;
+        }
+        default: {
+            return p;
+        }
+    }
+}
+
+static PatItem *additem (PatProg *prog, int *n, int kind) {
+    PatItem *it = &prog->items[(*n)++];
+    it->kind = (unsigned char) kind;
+    it->rep = 0;
+    it->c[0] = it->c[1] = '\0';
+    it->arg = it->len = 0;
+    return it;
+}
+
+/* find where matching can start to skip positions that cannot match */
+static void compilestart (PatProg *prog) {
+    const PatItem *it = prog->items;
+    int nopen = 0;
+    prog->first = prog->firstitem = -1;
+    prog->prefixlen = 0;
+    prog->prefix = NULL;
+    while (it->kind == PK_OPEN || it->kind == PK_POSITION) {
+        it++;
+        nopen++;
+    }
+    if (nopen >= LUA_MAXCAPTURES) {
+        return; /* every position raises `too many captures' */
+    }
+    switch (it->kind) {
+        case PK_LITERAL:
+            prog->first = uchar(prog->lit[it->arg]);
+            prog->prefix = prog->lit + it->arg;
+            prog->prefixlen = it->len;
+            break;
+        case PK_BALANCE:
+            prog->first = uchar(it->c[0]);
+            break;
+        case PK_CHAR:
+        case PK_CLASS:
+        case PK_SET:
+            if (it->rep == 0 || it->rep == '+') {
+                if (it->kind == PK_CHAR) {
+                    prog->first = uchar(it->c[0]);
+                } else {
+                    prog->firstitem = (int) (it - prog->items);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+** Compile `p' into a new userdata pushed onto the stack; if `p' is malformed
+** nothing is pushed and NULL is returned.
+*/
+static PatProg *compile (lua_State *L, const char *p) {
+    size_t l = strlen(p);
+    int nsets = 0;
+    int n = 0;
+    int nlit = 0;
+    PatProg *prog;
+    const char *q;
+    for (q = p; (q = strchr(q, '[')) != NULL; q++) {
+        nsets++;
+    }
+    prog = (PatProg *) lua_newuserdata(L, sizeof(PatProg) + (l + 1) * sizeof(PatItem) + nsets * sizeof(PatSet) + l);
+    prog->items = (PatItem *) (prog + 1);
+    prog->sets = (PatSet *) (prog->items + l + 1);
+    prog->lit = (char *) (prog->sets + nsets);
+    nsets = 0;
+    for (;;) {
+        PatItem *it;
+        switch (*p) {
+            case '(': {
+                if (*(p + 1) == ')') {
+                    additem(prog, &n, PK_POSITION);
+                    p += 2;
+                } else {
+                    additem(prog, &n, PK_OPEN);
+                    p++;
+                }
+                continue;
+            }
+            case ')': {
+                additem(prog, &n, PK_CLOSE);
+                p++;
+                continue;
+            }
+            case L_ESC: {
+                if (*(p + 1) == 'b') {
+                    if (*(p + 2) == '\0' || *(p + 3) == '\0') {
+                        break; /* unbalanced pattern */
+                    }
+                    it = additem(prog, &n, PK_BALANCE);
+                    it->c[0] = *(p + 2);
+                    it->c[1] = *(p + 3);
+                    p += 4;
+                    continue;
+                } else if (*(p + 1) == 'f') {
+                    const char *ep;
+                    p += 2;
+                    if (*p != '[' || (ep = compileclassend(p)) == NULL) {
+                        break; /* malformed frontier */
+                    }
+                    it = additem(prog, &n, PK_FRONTIER);
+                    it->arg = nsets;
+                    compileset(&prog->sets[nsets++], p, ep - 1);
+                    p = ep;
+                    continue;
+                } else if (isdigit(uchar(*(p + 1)))) {
+                    it = additem(prog, &n, PK_BACKREF);
+                    it->c[0] = *(p + 1);
+                    p += 2;
+                    continue;
+                }
+                goto item;
+            }
+            case '\0': {
+                additem(prog, &n, PK_END);
+                compilestart(prog);
+                return prog;
+            }
+            case '$': {
+                if (*(p + 1) == '\0') {
+                    additem(prog, &n, PK_ENDANCHOR);
+                    compilestart(prog);
+                    return prog;
+                }
+                goto item;
+            }
+            default:
+            item : {
+                const char *ep = compileclassend(p);
+                int rep;
+                if (ep == NULL) {
+                    break; /* malformed item */
+                }
+                rep = (*ep == '?' || *ep == '*' || *ep == '+' || *ep == '-') ? *ep : 0;
+                if (*p == '.') {
+                    it = additem(prog, &n, PK_ANY);
+                } else if (*p == '[') {
+                    it = additem(prog, &n, PK_SET);
+                    it->arg = nsets;
+                    compileset(&prog->sets[nsets++], p, ep - 1);
+                } else {
+                    char c = (*p == L_ESC) ? *(p + 1) : *p;
+                    if (*p == L_ESC && c != '\0' && strchr(PATCLASSES, tolower(uchar(c))) != NULL) {
+                        it = additem(prog, &n, PK_CLASS);
+                    } else if (rep == 0) { /* extend a literal run */
+                        if (n == 0 || prog->items[n - 1].kind != PK_LITERAL) {
+                            it = additem(prog, &n, PK_LITERAL);
+                            it->arg = nlit;
+                        }
+                        prog->items[n - 1].len++;
+                        prog->lit[nlit++] = c;
+                        p = ep;
+                        continue;
+                    } else {
+                        it = additem(prog, &n, PK_CHAR);
+                    }
+                    it->c[0] = c;
+                }
+                it->rep = (unsigned char) rep;
+                p = (rep != 0) ? ep + 1 : ep;
+                continue;
+            }
+        }
+        lua_pop(L, 1); /* malformed; leave it to `match' */
+        return NULL;
+    }
+}
+
+static const char *cmatch (MatchState *ms, const char *s, const PatItem *it);
+
+static int itemmatch (const MatchState *ms, const PatItem *it, int c) {
+    switch (it->kind) {
+        case PK_ANY:
+            return 1;
+        case PK_CHAR:
+            return (uchar(it->c[0]) == c);
+        case PK_CLASS:
+            return match_class(c, uchar(it->c[0]));
+        default:
+            return setmatch(&ms->prog->sets[it->arg], c);
+    }
+}
+
+/* true if the item after a repetition cannot match at `s' */
+#define cannotfollow(ms, it, s)                                                                                        \
+    ((it)->kind == PK_LITERAL && ((s) == (ms)->src_end || *(s) != (ms)->prog->lit[(it)->arg]))
+
+static const char *cmax_expand (MatchState *ms, const char *s, const PatItem *it) {
+    ptrdiff_t i = 0; /* counts maximum expand for item */
+    if (it->kind == PK_ANY) {
+        i = ms->src_end - s;
+    } else {
+        while ((s + i) < ms->src_end && itemmatch(ms, it, uchar(*(s + i)))) {
+            i++;
+        }
+    }
+    /* keeps trying to match with the maximum repetitions */
+    while (i >= 0) {
+        const char *res;
+        if (!cannotfollow(ms, it + 1, s + i) && (res = cmatch(ms, (s + i), it + 1)) != NULL) {
+            return res;
+        }
+        i--; /* else didn't match; reduce 1 repetition to try again */
+    }
+    return NULL;
+}
+
+static const char *cmin_expand (MatchState *ms, const char *s, const PatItem *it) {
+    for (;;) {
+        const char *res;
+        if (!cannotfollow(ms, it + 1, s) && (res = cmatch(ms, s, it + 1)) != NULL) {
+            return res;
+        } else if (s < ms->src_end && itemmatch(ms, it, uchar(*s))) {
+            s++; /* try with one more repetition */
+        } else {
+            return NULL;
+        }
+    }
+}
+
+static const char *cstart_capture (MatchState *ms, const char *s, const PatItem *it, int what) {
+    const char *res;
+    int level = ms->level;
+    if (level >= LUA_MAXCAPTURES) {
+        luaL_error(ms->L, "too many captures");
+    }
+    ms->capture[level].init = s;
+    ms->capture[level].len = what;
+    ms->level = level + 1;
+    if ((res = cmatch(ms, s, it)) == NULL) { /* match failed? */
+        ms->level--; /* undo capture */
+    }
+    return res;
+}
+
+static const char *cend_capture (MatchState *ms, const char *s, const PatItem *it) {
+    int l = capture_to_close(ms);
+    const char *res;
+    ms->capture[l].len = s - ms->capture[l].init; /* close capture */
+    if ((res = cmatch(ms, s, it)) == NULL) { /* match failed? */
+        ms->capture[l].len = CAP_UNFINISHED; /* undo capture */
+    }
+    return res;
+}
+
+static const char *cmatch (MatchState *ms, const char *s, const PatItem *it) {
+    for (;; it++) {
+        switch (it->kind) {
+            case PK_END: {
+                return s;
+            }
+            case PK_ENDANCHOR: {
+                return (s == ms->src_end) ? s : NULL;
+            }
+            case PK_OPEN: {
+                return cstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+            }
+            case PK_POSITION: {
+                return cstart_capture(ms, s, it + 1, CAP_POSITION);
+            }
+            case PK_CLOSE: {
+                return cend_capture(ms, s, it + 1);
+            }
+            case PK_BALANCE: {
+                if ((s = matchbalance(ms, s, it->c)) == NULL) {
+                    return NULL;
+                }
+                break;
+            }
+            case PK_FRONTIER: {
+                const PatSet *set = &ms->prog->sets[it->arg];
+                char previous = (s == ms->src_init) ? '\0' : *(s - 1);
+                if (setmatch(set, uchar(previous)) || !setmatch(set, uchar(*s))) {
+                    return NULL;
+                }
+                break;
+            }
+            case PK_BACKREF: {
+                if ((s = match_capture(ms, s, uchar(it->c[0]))) == NULL) {
+                    return NULL;
+                }
+                break;
+            }
+            case PK_LITERAL: {
+                if ((size_t) (ms->src_end - s) < (size_t) it->len || memcmp(s, ms->prog->lit + it->arg, it->len) != 0) {
+                    return NULL;
+                }
+                s += it->len;
+                break;
+            }
+            default: { /* single item */
+                int m = s < ms->src_end && itemmatch(ms, it, uchar(*s));
+                switch (it->rep) {
+                    case '?': { /* optional */
+                        const char *res;
+                        if (m && ((res = cmatch(ms, s + 1, it + 1)) != NULL)) {
+                            return res;
+                        }
+                        break; /* else continue at the next item */
+                    }
+                    case '*': { /* 0 or more repetitions */
+                        return cmax_expand(ms, s, it);
+                    }
+                    case '+': { /* 1 or more repetitions */
+                        return (m ? cmax_expand(ms, s + 1, it) : NULL);
+                    }
+                    case '-': { /* 0 or more repetitions (minimum) */
+                        return cmin_expand(ms, s, it);
+                    }
+                    default: {
+                        if (!m) {
+                            return NULL;
+                        }
+                        s++;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
+
+/* match at `s' with the compiled pattern if there is one */
+#define domatch(ms, s, p) (((ms)->prog != NULL) ? cmatch((ms), (s), (ms)->prog->items) : match((ms), (s), (p)))
+
+/*
+** Returns the first position from `s' where a match could start, or NULL if
+** there is none; matches may start anywhere unless `canskip' is true.
+*/
+#define canskip(ms) ((ms)->prog != NULL && ((ms)->prog->first >= 0 || (ms)->prog->firstitem >= 0))
+
+static const char *skipto (const MatchState *ms, const char *s) {
+    const PatProg *prog = ms->prog;
+    if (prog->prefixlen > 1) {
+        return lmemfind(s, ms->src_end - s, prog->prefix, prog->prefixlen);
+    } else if (prog->first >= 0) {
+        return (const char *) memchr(s, prog->first, ms->src_end - s);
+    } else {
+        const PatItem *it = &prog->items[prog->firstitem];
+        for (; s < ms->src_end; s++) {
+            if (itemmatch(ms, it, uchar(*s))) {
+                return s;
+            }
+        }
+        return NULL;
+    }
+}
+
+/*
+** Each state keeps the compiled forms of its most recently used patterns,
+** and separately of its most recently used format strings. Entries are
+** keyed by the address of the pattern text, which is unique while the
+** string is alive; the environment of the cache keeps both the pattern
+** strings and their compiled forms alive.
+*/
+
+#define PATCACHESIZE 32
+
+#define CACHE_PATTERN 0
+#define CACHE_FORMAT 1
+#define CACHEKINDS 2
+
+typedef struct PatCache {
+    unsigned int clock;
+    struct {
+        const char *p;
+        void *prog; /* NULL if `p' is interpreted */
+        unsigned int used;
+    } entries[CACHEKINDS][PATCACHESIZE];
+} PatCache;
+
+static void pushpatcache (lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "_PATTERNCACHE");
+    if (lua_isnil(L, -1)) {
+        PatCache *cache;
+        lua_pop(L, 1);
+        cache = (PatCache *) lua_newuserdata(L, sizeof(PatCache));
+        memset(cache, 0, sizeof(PatCache));
+        lua_createtable(L, 2 * CACHEKINDS * PATCACHESIZE, 0);
+        lua_setfenv(L, -2);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, "_PATTERNCACHE");
+    }
+}
+
+static void *compileformat (lua_State *L, const char *p, size_t l);
+
+/*
+** Get the compiled form of the pattern or format string `p' of the given
+** `kind', found within the string at `idx' of the calling function, which
+** must have the pattern cache as its first upvalue. Returns NULL if `p' is
+** not compiled. If `push' is set, pushes the userdata holding the compiled
+** form, or nil, to keep it alive.
+*/
+static void *getcached (lua_State *L, int idx, const char *p, int kind, int push) {
+    PatCache *cache = (PatCache *) lua_touserdata(L, lua_upvalueindex(1));
+    void *prog;
+    int slot = 0;
+    int i;
+    if (cache == NULL || lua_objlen(L, lua_upvalueindex(1)) != sizeof(PatCache)) {
+        if (push) {
+            lua_pushnil(L);
+        }
+        return NULL; /* no cache */
+    }
+    for (i = 0; i < PATCACHESIZE; i++) {
+        if (cache->entries[kind][i].p == p) {
+            cache->entries[kind][i].used = ++cache->clock;
+            if (push) {
+                lua_getfenv(L, lua_upvalueindex(1));
+                lua_rawgeti(L, -1, 2 * (kind * PATCACHESIZE + i) + 2);
+                lua_remove(L, -2);
+            }
+            return cache->entries[kind][i].prog;
+        } else if (cache->entries[kind][i].used < cache->entries[kind][slot].used) {
+            slot = i; /* least recently used so far */
+        }
+    }
+    prog = (kind == CACHE_PATTERN) ? (void *) compile(L, p) : compileformat(L, p, lua_objlen(L, idx));
+    if (prog == NULL) {
+        lua_pushnil(L);
+    }
+    lua_setvaluetaint(L, -1, NULL); /* shared by all callers */
+    lua_getfenv(L, lua_upvalueindex(1));
+    lua_pushvalue(L, idx);
+    lua_setvaluetaint(L, -1, NULL);
+    lua_rawseti(L, -2, 2 * (kind * PATCACHESIZE + slot) + 1);
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, 2 * (kind * PATCACHESIZE + slot) + 2);
+    lua_pop(L, push ? 1 : 2);
+    cache->entries[kind][slot].p = p;
+    cache->entries[kind][slot].prog = prog;
+    cache->entries[kind][slot].used = ++cache->clock;
+    return prog;
+}
+
+#define getprog(L, idx, p, push) ((PatProg *) getcached((L), (idx), (p), CACHE_PATTERN, (push)))
+
+/* }====================================================== */
+
 static void push_onecapture (MatchState *ms, int i, const char *s, const char *e) {
     if (i >= ms->level) {
         if (i == 0) { /* ms->level == 0, too */
@@ -571,12 +1276,16 @@ static int str_find_aux (lua_State *L, int find) {
         int anchor = (*p == '^') ? (p++, 1) : 0;
         const char *s1 = s + init;
         ms.L = L;
+        ms.prog = getprog(L, 2, p, 0);
         ms.src_init = s;
         ms.src_end = s + l1;
         do {
             const char *res;
+            if (!anchor && canskip(&ms) && (s1 = skipto(&ms, s1)) == NULL) {
+                break; /* no position left where a match can start */
+            }
             ms.level = 0;
-            if ((res = match(&ms, s1, p)) != NULL) {
+            if ((res = domatch(&ms, s1, p)) != NULL) {
                 if (find) {
                     lua_pushinteger(L, s1 - s + 1); /* start */
                     lua_pushinteger(L, res - s); /* end */
@@ -606,12 +1315,16 @@ static int gmatch_aux (lua_State *L) {
     const char *p = lua_tostring(L, lua_upvalueindex(2));
     const char *src;
     ms.L = L;
+    ms.prog = (const PatProg *) lua_touserdata(L, lua_upvalueindex(4));
     ms.src_init = s;
     ms.src_end = s + ls;
     for (src = s + (size_t) lua_tointeger(L, lua_upvalueindex(3)); src <= ms.src_end; src++) {
         const char *e;
+        if (canskip(&ms) && (src = skipto(&ms, src)) == NULL) {
+            break; /* no position left where a match can start */
+        }
         ms.level = 0;
-        if ((e = match(&ms, src, p)) != NULL) {
+        if ((e = domatch(&ms, src, p)) != NULL) {
             lua_Integer newstart = e - s;
             if (e == src) {
                 newstart++; /* empty match? go at least one position */
@@ -629,7 +1342,8 @@ static int str_gmatch (lua_State *L) {
     luaL_checkstring(L, 2);
     lua_settop(L, 2);
     lua_pushinteger(L, 0);
-    lua_pushcclosure(L, gmatch_aux, 3);
+    getprog(L, 2, lua_tostring(L, 2), 1);
+    lua_pushcclosure(L, gmatch_aux, 4);
     return 1;
 }
 
@@ -700,14 +1414,23 @@ static int str_gsub (lua_State *L) {
     luaL_Buffer b;
     luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING || tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                   "string/function/table expected");
-    luaL_buffinit(L, &b);
     ms.L = L;
+    ms.prog = getprog(L, 2, p, 1); /* keep it alive while replacing */
     ms.src_init = src;
     ms.src_end = src + srcl;
+    luaL_buffinit(L, &b);
     while (n < max_s) {
         const char *e;
+        if (!anchor && canskip(&ms)) {
+            const char *next = skipto(&ms, src);
+            if (next == NULL) {
+                break; /* copy the rest of the subject below */
+            }
+            luaL_addlstring(&b, src, next - src);
+            src = next;
+        }
         ms.level = 0;
-        e = match(&ms, src, p);
+        e = domatch(&ms, src, p);
         if (e) {
             n++;
             add_value(&ms, &b, src, e);
@@ -818,13 +1541,318 @@ static void addintlen (char *form) {
     form[l + 1] = '\0';
 }
 
+/* Add the conversion `conv' of argument `arg', as specified by `form' */
+static void addformat (lua_State *L, luaL_Buffer *b, int arg, int conv, char *form) {
+    char buff[MAX_ITEM]; /* to store the formatted item */
+    switch (conv) {
+        case 'c': {
+            sprintf(buff, form, (int) luaL_checknumber(L, arg));
+            break;
+        }
+        case 'd':
+        case 'i': {
+            long num = lua_tolong(L, arg);
+            addintlen(form);
+            sprintf(buff, form, num);
+            break;
+        }
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X': {
+            lua_Number num = luaL_checknumber(L, arg);
+            addintlen(form);
+            sprintf(buff, form, (unsigned long) num);
+            break;
+        }
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'g':
+        case 'G': {
+            sprintf(buff, form, (double) luaL_checknumber(L, arg));
+            break;
+        }
+        case 'F': {
+            form[strlen(form) - 1] = 'f';
+            sprintf(buff, form, (double) luaL_checknumber(L, arg));
+            break;
+        }
+        case 'q': {
+            addquoted(L, b, arg);
+            return; /* skip the 'addsize' at the end */
+        }
+        case 's': {
+            size_t l;
+            const char *s = luaL_checklstring(L, arg, &l);
+            if (!strchr(form, '.') && l >= 100) {
+                /* no precision and string is too long to be formatted; keep original string */
+                lua_pushvalue(L, arg);
+                luaL_addvalue(b);
+                return; /* skip the `addsize' at the end */
+            } else {
+                sprintf(buff, form, s);
+                break;
+            }
+        }
+        default: { /* also treat cases `pnLlh' */
+            luaL_error(L, "invalid option in `format'");
+        }
+    }
+    luaL_addlstring(b, buff, strlen(buff));
+}
+
+/*
+** {======================================================
+** Compiled format strings
+** =======================================================
+*/
+
+/* fixed-point conversions up to this precision avoid `sprintf' */
+#define MAX_FASTPREC 15
+
+#define FF_SPRINTF 0 /* formatted by `addformat' */
+#define FF_INT 1 /* plain `%d' or `%i' */
+#define FF_STR 2 /* plain `%s' */
+#define FF_FIXED 3 /* `%.Nf' */
+
+typedef struct FmtItem {
+    size_t lit; /* offset of the literal text before the conversion */
+    size_t litlen;
+    int arg; /* argument given by a `%n$' prefix, or 0 for the next one */
+    char conv; /* conversion; `%' if none, 0 after the last literal */
+    char fast; /* FF_* */
+    char prec; /* precision of FF_FIXED */
+    char form[MAX_FORMAT]; /* as built by `scanformat' */
+} FmtItem;
+
+typedef struct FmtProg {
+    FmtItem *items;
+} FmtProg;
+
+static const unsigned long long fastpow10[MAX_FASTPREC + 1] = {
+    1ull,           10ull,           100ull,           1000ull,
+    10000ull,       100000ull,       1000000ull,       10000000ull,
+    100000000ull,   1000000000ull,   10000000000ull,   100000000000ull,
+    1000000000000ull, 10000000000000ull, 100000000000000ull, 1000000000000000ull,
+};
+
+static char *adddigits (char *end, unsigned long long u) {
+    do {
+        *--end = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    return end;
+}
+
+static void addinteger (luaL_Buffer *b, long n) {
+    char buff[3 * sizeof(long) + 2];
+    char *end = buff + sizeof(buff);
+    char *p = adddigits(end, (n < 0) ? 0ull - (unsigned long long) n : (unsigned long long) n);
+    if (n < 0) {
+        *--p = '-';
+    }
+    luaL_addlstring(b, p, end - p);
+}
+
+/*
+** Add `x' with `prec' decimals, rounded as `printf' rounds the exact value
+** of `x' (to nearest, ties to even). The mantissa is scaled by the power
+** of ten in integer arithmetic, so the result does not depend on how the
+** compiler treats floating point. Returns 0 if `x' is not finite or too
+** large, leaving it to `sprintf'.
+*/
+static int addfixed (luaL_Buffer *b, double x, int prec) {
+#if defined(__SIZEOF_INT128__)
+    char buff[MAX_ITEM];
+    char *end = buff + sizeof(buff);
+    char *p;
+    unsigned long long bits;
+    unsigned long long m;
+    unsigned long long u;
+    int shift;
+    __uint128_t n;
+    lua_assert(sizeof(double) == sizeof(bits));
+    memcpy(&bits, &x, sizeof(bits));
+    m = bits & ((1ull << 52) - 1);
+    shift = (int) ((bits >> 52) & 0x7ff);
+    if (shift == 0x7ff) {
+        return 0; /* infinity or NaN */
+    } else if (shift != 0) {
+        m |= 1ull << 52;
+    } else {
+        shift = 1; /* subnormal */
+    }
+    shift = 1075 - shift; /* x = m / 2^shift */
+    if (shift < 0) {
+        return 0; /* 2^53 or more */
+    }
+    n = (__uint128_t) m * fastpow10[prec];
+    if (shift >= 128) {
+        u = 0; /* less than 2^103 / 2^128 */
+    } else {
+        __uint128_t q = (shift > 0) ? n >> shift : n;
+        if (shift > 0) {
+            __uint128_t rem = n - (q << shift);
+            __uint128_t half = (__uint128_t) 1 << (shift - 1);
+            if (rem > half || (rem == half && (q & 1) != 0)) {
+                q++;
+            }
+        }
+        if ((q >> 64) != 0) {
+            return 0;
+        }
+        u = (unsigned long long) q;
+    }
+    if (prec > 0) {
+        unsigned long long pu = fastpow10[prec];
+        char *f = adddigits(end, u % pu);
+        while (end - f < prec) {
+            *--f = '0';
+        }
+        *--f = '.';
+        p = adddigits(f, u / pu);
+    } else {
+        p = adddigits(end, u);
+    }
+    if (bits >> 63) {
+        *--p = '-';
+    }
+    luaL_addlstring(b, p, end - p);
+    return 1;
+#else
+    (void) b;
+    (void) x;
+    (void) prec;
+    return 0;
+#endif
+}
+
+/*
+** Compile the format string `p' of length `l' into a list of literal runs
+** and conversions with their `scanformat' forms, noting those that have a
+** fast path. Returns NULL, pushing nothing, if `p' is malformed so that
+** its errors are raised by the interpreter when reached.
+*/
+static void *compileformat (lua_State *L, const char *p, size_t l) {
+    const char *e = p + l;
+    const char *q;
+    size_t start = 0;
+    int n = 1;
+    FmtProg *prog;
+    for (q = p; (q = (const char *) memchr(q, L_ESC, e - q)) != NULL; q++) {
+        n++;
+    }
+    prog = (FmtProg *) lua_newuserdata(L, sizeof(FmtProg) + n * sizeof(FmtItem));
+    prog->items = (FmtItem *) (prog + 1);
+    n = 0;
+    for (q = p;;) {
+        FmtItem *it = &prog->items[n++];
+        const char *spec;
+        const char *width;
+        const char *dot;
+        const char *digits;
+        it->lit = start;
+        it->arg = 0;
+        it->fast = FF_SPRINTF;
+        it->prec = 0;
+        q = (const char *) memchr(q, L_ESC, e - q);
+        if (q == NULL) {
+            it->litlen = l - start;
+            it->conv = 0;
+            return prog;
+        } else if (q + 1 < e && *(q + 1) == L_ESC) { /* %% */
+            it->litlen = q + 1 - p - start;
+            it->conv = L_ESC;
+            q += 2;
+            start = q - p;
+            continue;
+        }
+        it->litlen = q - p - start;
+        spec = scanarg(++q, &it->arg);
+        for (q = spec; q < e && *q != '\0' && strchr("-+ #0", *q); q++) {
+        }
+        for (width = q; q < e && isdigit(uchar(*q)); q++) {
+        }
+        dot = q;
+        if (q < e && *q == '.') {
+            q++;
+        }
+        for (digits = q; q < e && isdigit(uchar(*q)); q++) {
+        }
+        if (dot - width > 2 || q - digits > 2 || q - spec > MAX_FORMAT - 4 || q == e || *q == '\0' ||
+            !strchr("cdiouxXeEfgGFqs", *q)) {
+            lua_pop(L, 1); /* malformed; leave it to `str_format' */
+            return NULL;
+        }
+        it->conv = *q;
+        it->form[0] = L_ESC;
+        memcpy(it->form + 1, spec, q + 1 - spec);
+        it->form[q + 2 - spec] = '\0';
+        if (q == spec && (*q == 'd' || *q == 'i')) {
+            it->fast = FF_INT;
+        } else if (q == spec && *q == 's') {
+            it->fast = FF_STR;
+        } else if (*q == 'f' && spec == width && width == dot && dot < digits) {
+            int prec = (q - digits == 2) ? 10 * (digits[0] - '0') + (digits[1] - '0')
+                                         : (q - digits == 1) ? digits[0] - '0' : 0;
+            if (prec <= MAX_FASTPREC) {
+                it->fast = FF_FIXED;
+                it->prec = (char) prec;
+            }
+        }
+        q++;
+        start = q - p;
+    }
+}
+
+/* }====================================================== */
+
 static int str_format (lua_State *L) {
     int arg = 1;
     size_t sfl;
     const char *strfrmt = luaL_checklstring(L, arg, &sfl);
     const char *strfrmt_end = strfrmt + sfl;
+    FmtProg *prog = (FmtProg *) getcached(L, arg, strfrmt, CACHE_FORMAT, 0);
     luaL_Buffer b;
     luaL_buffinit(L, &b);
+    if (prog != NULL) {
+        const FmtItem *it;
+        for (it = prog->items;; it++) {
+            luaL_addlstring(&b, strfrmt + it->lit, it->litlen);
+            if (it->conv == 0) {
+                break;
+            } else if (it->conv == L_ESC) {
+                continue;
+            }
+            arg = (it->arg != 0) ? it->arg : arg + 1;
+            switch (it->fast) {
+                case FF_INT: {
+                    addinteger(&b, lua_tolong(L, arg));
+                    continue;
+                }
+                case FF_STR: {
+                    size_t l;
+                    const char *s = luaL_checklstring(L, arg, &l);
+                    luaL_addlstring(&b, s, (l >= 100) ? l : strlen(s)); /* as `addformat' */
+                    continue;
+                }
+                case FF_FIXED: {
+                    if (addfixed(&b, (double) luaL_checknumber(L, arg), it->prec)) {
+                        continue;
+                    }
+                    break;
+                }
+            }
+            {
+                char form[MAX_FORMAT];
+                memcpy(form, it->form, sizeof(form));
+                addformat(L, &b, arg, it->conv, form);
+            }
+        }
+        luaL_pushresult(&b);
+        return 1;
+    }
     while (strfrmt < strfrmt_end) {
         if (*strfrmt != L_ESC) {
             luaL_addchar(&b, *strfrmt++);
@@ -832,66 +1860,10 @@ static int str_format (lua_State *L) {
             luaL_addchar(&b, *strfrmt++); /* %% */
         } else { /* format item */
             char form[MAX_FORMAT]; /* to store the format (`%...') */
-            char buff[MAX_ITEM]; /* to store the formatted item */
             ++arg;
             strfrmt = scanarg(strfrmt, &arg);
             strfrmt = scanformat(L, strfrmt, strfrmt_end, form);
-            switch (*strfrmt++) {
-                case 'c': {
-                    sprintf(buff, form, (int) luaL_checknumber(L, arg));
-                    break;
-                }
-                case 'd':
-                case 'i': {
-                    long num = lua_tolong(L, arg);
-                    addintlen(form);
-                    sprintf(buff, form, num);
-                    break;
-                }
-                case 'o':
-                case 'u':
-                case 'x':
-                case 'X': {
-                    lua_Number num = luaL_checknumber(L, arg);
-                    addintlen(form);
-                    sprintf(buff, form, (unsigned long) num);
-                    break;
-                }
-                case 'e':
-                case 'E':
-                case 'f':
-                case 'g':
-                case 'G': {
-                    sprintf(buff, form, (double) luaL_checknumber(L, arg));
-                    break;
-                }
-                case 'F': {
-                    form[strlen(form) - 1] = 'f';
-                    sprintf(buff, form, (double) luaL_checknumber(L, arg));
-                    break;
-                }
-                case 'q': {
-                    addquoted(L, &b, arg);
-                    continue; /* skip the 'addsize' at the end */
-                }
-                case 's': {
-                    size_t l;
-                    const char *s = luaL_checklstring(L, arg, &l);
-                    if (!strchr(form, '.') && l >= 100) {
-                        /* no precision and string is too long to be formatted; keep original string */
-                        lua_pushvalue(L, arg);
-                        luaL_addvalue(&b);
-                        continue; /* skip the `addsize' at the end */
-                    } else {
-                        sprintf(buff, form, s);
-                        break;
-                    }
-                }
-                default: { /* also treat cases `pnLlh' */
-                    return luaL_error(L, "invalid option in `format'");
-                }
-            }
-            luaL_addlstring(&b, buff, strlen(buff));
+            addformat(L, &b, arg, uchar(*strfrmt++), form);
         }
     }
     luaL_pushresult(&b);
@@ -923,56 +1895,191 @@ static int str_trim (lua_State *L) {
     return 1;
 }
 
-static int str_split (lua_State *L) {
-    const char *delim = luaL_checkstring(L, 1);
-    const char *str = luaL_checklstring(L, 2, NULL);
-    const char *end = str + strlen(str);
-    int limit = luaL_optint(L, 3, 0);
-    int count = 0;
+/*
+** {======================================================
+** Delimiter scanning
+** =======================================================
+*/
 
-    lua_settop(L, 2);
+#define MAXVECDELIMS 4 /* sets up to this size are scanned 16 bytes at a time */
+#define SPLITSTACKSTEP 64 /* fields pushed between stack checks */
+
+typedef struct DelimSet {
+    unsigned char bits[UCHAR_MAX / CHAR_BIT + 1];
+    unsigned char c[MAXVECDELIMS]; /* the distinct delimiters, if few */
+    int n; /* number of distinct delimiters */
+} DelimSet;
+
+static void initdelims (DelimSet *ds, const char *delim, size_t l) {
+    memset(ds->bits, 0, sizeof(ds->bits));
+    ds->n = 0;
+    for (; l > 0; l--, delim++) {
+        int c = uchar(*delim);
+        if (!testbit(ds, c)) {
+            setbit(ds, c);
+            if (ds->n < MAXVECDELIMS) {
+                ds->c[ds->n] = uchar(c);
+            }
+            ds->n++;
+        }
+    }
+}
 
-    /* Note; use of "str <= end" below is intentional as we consider the null
-     * terminator as part of the string. */
+/*
+** Mask of the bytes in the 16 at `s' that are in `ds', which holds at most
+** MAXVECDELIMS delimiters; `vecfirst' gives the offset of the lowest one.
+*/
+#if defined(LUAI_SCANSSE2)
 
-    if (!limit || limit > 1) {
-        while (str <= end) {
-            size_t len = strcspn(str, delim);
-            luaL_checkstack(L, count + 1, "strsplit()");
-            lua_pushlstring(L, str, len);
-            str += len + 1;
-            ++count;
+typedef unsigned int VecMask;
 
-            if (count == (limit - 1)) {
-                break;
-            }
-        }
+static VecMask vecmatch (const DelimSet *ds, const char *s) {
+    __m128i v = _mm_loadu_si128((const __m128i *) s);
+    __m128i eq = _mm_cmpeq_epi8(v, _mm_set1_epi8((char) ds->c[0]));
+    int i;
+    for (i = 1; i < ds->n; i++) {
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, _mm_set1_epi8((char) ds->c[i])));
     }
+    return (VecMask) _mm_movemask_epi8(eq);
+}
+
+#elif defined(LUAI_SCANNEON)
 
-    /* push remainder of string */
-    if (str <= end) {
-        luaL_checkstack(L, count + 1, "strsplit()");
-        lua_pushstring(L, str);
-        ++count;
+typedef uint64_t VecMask; /* 4 bits per byte */
+
+static VecMask vecmatch (const DelimSet *ds, const char *s) {
+    uint8x16_t v = vld1q_u8((const uint8_t *) s);
+    uint8x16_t eq = vceqq_u8(v, vdupq_n_u8(ds->c[0]));
+    int i;
+    for (i = 1; i < ds->n; i++) {
+        eq = vorrq_u8(eq, vceqq_u8(v, vdupq_n_u8(ds->c[i])));
     }
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+#endif
 
-    return count;
+#if defined(LUAI_SCANSSE2) || defined(LUAI_SCANNEON)
+
+static int vecfirst (VecMask m) {
+    int i;
+#if defined(__GNUC__) && defined(LUAI_SCANNEON)
+    i = __builtin_ctzll(m);
+#elif defined(__GNUC__)
+    i = __builtin_ctz(m);
+#else
+    for (i = 0; !(m & 1); i++) {
+        m >>= 1;
+    }
+#endif
+#if defined(LUAI_SCANNEON)
+    i >>= 2;
+#endif
+    return i;
 }
 
-static int str_splittable (lua_State *L) {
-    int nres = str_split(L);
-    int tidx = lua_absindex(L, -(nres + 1));
+#endif
+
+/* Return the first delimiter from `ds' in [s, e), or `e' if there is none */
+static const char *scandelim (const DelimSet *ds, const char *s, const char *e) {
+    if (ds->n == 0) {
+        return e;
+    } else if (ds->n == 1) {
+        const char *p = (const char *) memchr(s, ds->c[0], e - s);
+        return (p != NULL) ? p : e;
+    }
+#if defined(LUAI_SCANSSE2) || defined(LUAI_SCANNEON)
+    if (ds->n <= MAXVECDELIMS) {
+        for (; e - s >= 16; s += 16) {
+            VecMask m = vecmatch(ds, s);
+            if (m != 0) {
+                return s + vecfirst(m);
+            }
+        }
+    }
+#endif
+    for (; s < e; s++) {
+        if (testbit(ds, uchar(*s))) {
+            return s;
+        }
+    }
+    return e;
+}
 
-    lua_createtable(L, nres, 0);
-    lua_replace(L, tidx);
+/*
+** Read the arguments shared by `strsplit' and `strsplittable'. Like the
+** reference client, both stop at the first embedded zero of the string and
+** of the delimiters unless the "strsplit" compatibility option is set. The
+** number of fields is at most `limit', or unbounded if it is zero.
+*/
+static const char *splitargs (lua_State *L, DelimSet *ds, const char **end, int *maxfields) {
+    size_t dl;
+    size_t sl;
+    const char *delim = luaL_checklstring(L, 1, &dl);
+    const char *str = luaL_checklstring(L, 2, &sl);
+    int limit = luaL_optint(L, 3, 0);
+    if (!lua_getcompatopt(L, LUA_COMPATSTRSPLIT)) {
+        dl = strlen(delim);
+        sl = strlen(str);
+    }
+    initdelims(ds, delim, dl);
+    *end = str + sl;
+    *maxfields = (limit == 0) ? INT_MAX : (limit > 1) ? limit : 1;
+    lua_settop(L, 2);
+    return str;
+}
 
-    for (; nres > 0; --nres) {
-        lua_rawseti(L, tidx, nres);
+/* Return the end of the field starting at `s', the `count'th one */
+#define fieldend(ds, s, e, count, maxfields) (((count) < (maxfields)) ? scandelim((ds), (s), (e)) : (e))
+
+static int str_split (lua_State *L) {
+    DelimSet ds;
+    const char *end;
+    int maxfields;
+    const char *str = splitargs(L, &ds, &end, &maxfields);
+    int count = 0;
+    for (;;) {
+        const char *e = fieldend(&ds, str, end, count + 1, maxfields);
+        if (count % SPLITSTACKSTEP == 0) {
+            luaL_checkstack(L, SPLITSTACKSTEP + LUA_MINSTACK, "strsplit()"); /* keep room for errors */
+        }
+        lua_pushlstring(L, str, e - str);
+        count++;
+        if (e == end) {
+            return count;
+        }
+        str = e + 1;
     }
+}
 
+static int str_splittable (lua_State *L) {
+    DelimSet ds;
+    const char *end;
+    int maxfields;
+    const char *str = splitargs(L, &ds, &end, &maxfields);
+    const char *s = str;
+    int count = 1;
+    int i;
+    for (;;) { /* count the fields to presize the table */
+        const char *e = fieldend(&ds, s, end, count, maxfields);
+        if (e == end) {
+            break;
+        }
+        s = e + 1;
+        count++;
+    }
+    lua_createtable(L, count, 0);
+    for (i = 1; i <= count; i++) {
+        const char *e = fieldend(&ds, str, end, i, maxfields);
+        lua_pushlstring(L, str, e - str);
+        lua_rawseti(L, -2, i);
+        str = e + 1;
+    }
     return 1;
 }
 
+/* }====================================================== */
+
 static int str_join (lua_State *L) {
     size_t seplen;
     const char *separator = luaL_checklstring(L, 1, &seplen);
@@ -981,46 +2088,317 @@ static int str_join (lua_State *L) {
     if (pieces <= 1 || seplen == 0) {
         lua_concat(L, pieces);
     } else {
-        luaL_Buffer buf;
-        luaL_buffinit(L, &buf);
+        const int full = lua_getcompatopt(L, LUA_COMPATSTRSPLIT);
 
         for (int i = 1; i <= pieces; ++i) {
-            luaL_addstring(&buf, luaL_checkstring(L, i + 1));
+            size_t len;
+            const char *piece = luaL_checklstring(L, i + 1, &len);
 
-            if (i < pieces) {
-                luaL_addlstring(&buf, separator, seplen);
+            if (!full && strlen(piece) != len) { /* reference client stops at embedded zeros */
+                lua_pushstring(L, piece);
+                lua_replace(L, i + 1);
             }
         }
 
-        luaL_pushresult(&buf);
+        lua_join(L, pieces, separator, seplen);
     }
 
     return 1;
 }
 
-static int strcmputf8i (lua_State *L) {
-    const char *str1 = luaL_checkstring(L, 1);
-    const char *str2 = luaL_checkstring(L, 2);
+/*
+** {======================================================
+** UTF-8 characters
+** =======================================================
+*/
+
+/*
+** Characters are delimited as `utf8.h' does: a lead byte gives the length of
+** its sequence whatever bytes follow it, and any other byte is a character
+** of its own. This agrees with the standard for valid UTF-8, and is what
+** `strlenutf8' has always counted for invalid input.
+*/
+static const unsigned char utf8lead[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 3, 4 };
+
+/* Length of the character at `s', truncated at `e' */
+static size_t utf8charlen (const char *s, const char *e) {
+    int c = uchar(*s);
+    size_t n = (c < 0xf8) ? utf8lead[c >> 4] : 1;
+    return (n <= (size_t) (e - s)) ? n : (size_t) (e - s);
+}
+
+#if defined(LUAI_SCANSSE2) || (defined(LUAI_SCANNEON) && (defined(__aarch64__) || defined(_M_ARM64)))
+#define LUAI_UTF8VEC
+#endif
+
+#if defined(LUAI_UTF8VEC)
+
+/*
+** Bit masks, one bit per byte, classifying the 16 bytes at `s': bytes with
+** the high bit set, continuation bytes, and lead bytes of 2, 3 and 4 byte
+** sequences. The byte values are compared as signed, so that 0x80 is -128.
+*/
+typedef struct Utf8Block {
+    unsigned int high;
+    unsigned int cont;
+    unsigned int lead2;
+    unsigned int lead3;
+    unsigned int lead4;
+} Utf8Block;
+
+#if defined(LUAI_SCANSSE2)
+
+typedef __m128i Utf8Vec;
+
+#define vecload(s) _mm_loadu_si128((const __m128i *) (s))
+#define vecbits(v) ((unsigned int) _mm_movemask_epi8(v))
+#define vechigh(v) vecbits(v)
+#define veccont(v) vecbits(_mm_cmplt_epi8((v), _mm_set1_epi8(-64)))
+#define vecrange(v, lo, hi) \
+    vecbits(_mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8((lo) - 1)), _mm_cmplt_epi8((v), _mm_set1_epi8((hi) + 1))))
+
+static unsigned int vecfoldeq (Utf8Vec a, Utf8Vec b) { /* case-insensitive equal ASCII bytes */
+    __m128i bit = _mm_set1_epi8(0x20);
+    __m128i lo = _mm_set1_epi8('A' - 1);
+    __m128i hi = _mm_set1_epi8('Z' + 1);
+    __m128i ua = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(a, lo), _mm_cmplt_epi8(a, hi)), bit);
+    __m128i ub = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(b, lo), _mm_cmplt_epi8(b, hi)), bit);
+    return vecbits(_mm_cmpeq_epi8(_mm_or_si128(a, ua), _mm_or_si128(b, ub)));
+}
+
+#else
 
-    int res = utf8casecmp(str1, str2);
+static unsigned int vecbits (uint8x16_t m) {
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t w = vandq_u8(m, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(w)) | ((unsigned int) vaddv_u8(vget_high_u8(w)) << 8);
+}
+
+typedef int8x16_t Utf8Vec;
+
+#define vecload(s) vreinterpretq_s8_u8(vld1q_u8((const uint8_t *) (s)))
+#define vechigh(v) vecbits(vcltq_s8((v), vdupq_n_s8(0)))
+#define veccont(v) vecbits(vcltq_s8((v), vdupq_n_s8(-64)))
+#define vecrange(v, lo, hi) vecbits(vandq_u8(vcgeq_s8((v), vdupq_n_s8(lo)), vcleq_s8((v), vdupq_n_s8(hi))))
+
+static unsigned int vecfoldeq (Utf8Vec a, Utf8Vec b) { /* case-insensitive equal ASCII bytes */
+    uint8x16_t bit = vdupq_n_u8(0x20);
+    int8x16_t lo = vdupq_n_s8('A');
+    int8x16_t hi = vdupq_n_s8('Z');
+    uint8x16_t ua = vandq_u8(vandq_u8(vcgeq_s8(a, lo), vcleq_s8(a, hi)), bit);
+    uint8x16_t ub = vandq_u8(vandq_u8(vcgeq_s8(b, lo), vcleq_s8(b, hi)), bit);
+    return vecbits(vceqq_u8(vorrq_u8(vreinterpretq_u8_s8(a), ua), vorrq_u8(vreinterpretq_u8_s8(b), ub)));
+}
+
+#endif
 
-    if (res > 1) {
-        res = 1;
-    } else if (res < -1) {
-        res = -1;
+static void utf8classify (const char *s, Utf8Block *blk) {
+    Utf8Vec v = vecload(s);
+    blk->high = vechigh(v);
+    if (blk->high != 0) {
+        blk->cont = veccont(v); /* 0x80 to 0xbf */
+        blk->lead2 = vecrange(v, -64, -33); /* 0xc0 to 0xdf */
+        blk->lead3 = vecrange(v, -32, -17); /* 0xe0 to 0xef */
+        blk->lead4 = vecrange(v, -16, -9); /* 0xf0 to 0xf7 */
+    } else {
+        blk->cont = blk->lead2 = blk->lead3 = blk->lead4 = 0;
     }
+}
 
-    lua_pushinteger(L, res);
+static int popcount16 (unsigned int m) {
+#if defined(__GNUC__)
+    return __builtin_popcount(m);
+#else
+    int n = 0;
+    for (; m != 0; m &= m - 1) {
+        n++;
+    }
+    return n;
+#endif
+}
+
+#endif
+
+/*
+** Number of characters in [s, e). Blocks of 16 bytes are counted at once
+** while every lead byte is followed by exactly the continuation bytes it
+** announces, as then each character starts with a byte that is not a
+** continuation. Anything else is stepped through from the last block that
+** ended on a character boundary.
+*/
+static size_t utf8count (const char *s, const char *e) {
+    size_t n = 0;
+#if defined(LUAI_UTF8VEC)
+    const char *mark = s; /* last block boundary between characters */
+    size_t nmark = 0;
+    unsigned int carry = 0; /* continuations owed by the previous block */
+    for (; e - s >= 16;) {
+        Utf8Block blk;
+        unsigned int owed;
+        utf8classify(s, &blk);
+        owed = carry | (blk.lead2 << 1) | (blk.lead3 << 1) | (blk.lead3 << 2) | (blk.lead4 << 1) | (blk.lead4 << 2) |
+               (blk.lead4 << 3);
+        if ((owed & 0xffff) != blk.cont) {
+            break; /* stray or missing continuation */
+        }
+        carry = owed >> 16;
+        n += 16 - popcount16(blk.cont);
+        s += 16;
+        if (carry == 0) {
+            mark = s;
+            nmark = n;
+        }
+    }
+    s = mark;
+    n = nmark;
+#endif
+    for (; s < e; n++) {
+        s += utf8charlen(s, e);
+    }
+    return n;
+}
+
+/* Skip `n' characters from `s', stopping at `e' */
+static const char *utf8skip (const char *s, const char *e, size_t n) {
+#if defined(LUAI_UTF8VEC)
+    for (; n >= 16 && e - s >= 16; s += 16, n -= 16) {
+        Utf8Block blk;
+        utf8classify(s, &blk);
+        if (blk.high != 0) {
+            break; /* not all ASCII */
+        }
+    }
+#endif
+    for (; n > 0 && s < e; n--) {
+        s += utf8charlen(s, e);
+    }
+    return s;
+}
+
+/*
+** Compare `a' and `b' ignoring case as `utf8casecmp' does. ASCII characters
+** are folded and compared here, 16 at a time where possible. Any other pair
+** of characters is copied into zero-padded buffers and compared there by
+** `utf8casecmp', so that its case folding applies without decoding past the
+** end of a string that ends in an incomplete sequence.
+*/
+static int utf8icmp (const char *a, size_t la, const char *b, size_t lb) {
+    const char *ea = a + la;
+    const char *eb = b + lb;
+#if defined(LUAI_UTF8VEC)
+    for (; ea - a >= 16 && eb - b >= 16; a += 16, b += 16) {
+        Utf8Vec va = vecload(a);
+        if (vecfoldeq(va, vecload(b)) != 0xffff || vechigh(va) != 0) {
+            break; /* a difference, or a character that is not ASCII */
+        }
+    }
+#endif
+    for (;;) {
+        int ca = (a < ea) ? uchar(*a) : 0;
+        int cb = (b < eb) ? uchar(*b) : 0;
+        if ((ca | cb) < 0x80) {
+            ca = (ca >= 'A' && ca <= 'Z') ? ca + ('a' - 'A') : ca;
+            cb = (cb >= 'A' && cb <= 'Z') ? cb + ('a' - 'A') : cb;
+            if (ca != cb) {
+                return (ca < cb) ? -1 : 1;
+            } else if (ca == 0) {
+                return 0; /* both strings ended */
+            }
+            a++;
+            b++;
+        } else {
+            char ba[8] = { 0 }; /* one character each, then zeros */
+            char bb[8] = { 0 };
+            size_t na = (a < ea) ? utf8charlen(a, ea) : 0;
+            size_t nb = (b < eb) ? utf8charlen(b, eb) : 0;
+            utf8_int32_t cpa;
+            utf8_int32_t cpb;
+            int res;
+            memcpy(ba, a, na);
+            memcpy(bb, b, nb);
+            utf8codepoint(ba, &cpa);
+            utf8codepoint(bb, &cpb);
+            if (cpa == 0 && cpb == 0) {
+                return 0; /* `utf8casecmp' stops at any zero, even an overlong one */
+            }
+            res = utf8casecmp(ba, bb);
+            if (res != 0) {
+                return (res < 0) ? -1 : 1;
+            }
+            a += na;
+            b += nb;
+        }
+    }
+}
+
+static int strcmputf8i (lua_State *L) {
+    const char *str1 = luaL_checkstring(L, 1);
+    const char *str2 = luaL_checkstring(L, 2);
+
+    lua_pushinteger(L, utf8icmp(str1, strlen(str1), str2, strlen(str2)));
     return 1;
 }
 
 static int strlenutf8 (lua_State *L) {
     const char *str = luaL_checkstring(L, 1);
 
-    lua_pushinteger(L, utf8len(str));
+    lua_pushinteger(L, (lua_Integer) utf8count(str, str + strlen(str)));
     return 1;
 }
 
+static int str_utf8sub (lua_State *L) {
+    size_t l;
+    const char *s = luaL_checklstring(L, 1, &l);
+    const char *e = s + l;
+    ptrdiff_t start = luaL_checkinteger(L, 2);
+    ptrdiff_t end = luaL_optinteger(L, 3, -1);
+    if (start < 0 || end < 0) { /* relative to the character count */
+        size_t len = utf8count(s, e);
+        start = posrelat(start, len);
+        end = posrelat(end, len);
+    }
+    if (start < 1) {
+        start = 1;
+    }
+    if (start <= end) {
+        const char *p = utf8skip(s, e, (size_t) (start - 1));
+        const char *q = utf8skip(p, e, (size_t) (end - start + 1));
+        lua_pushlstring(L, p, q - p);
+    } else {
+        lua_pushliteral(L, "");
+    }
+    return 1;
+}
+
+static int utf8iteraux (lua_State *L) {
+    size_t l;
+    const char *s = luaL_checklstring(L, 1, &l);
+    ptrdiff_t pos = luaL_checkinteger(L, 2); /* position of the previous character */
+    size_t i = 0;
+    size_t n;
+    if (pos > 0 && (size_t) pos <= l) {
+        i = (size_t) pos - 1;
+        i += utf8charlen(s + i, s + l);
+    }
+    if (i >= l) {
+        return 0; /* no more characters */
+    }
+    n = utf8charlen(s + i, s + l);
+    lua_pushinteger(L, (lua_Integer) (i + 1));
+    lua_pushlstring(L, s + i, n);
+    return 2;
+}
+
+static int str_utf8iter (lua_State *L) {
+    luaL_checkstring(L, 1);
+    lua_pushcfunction(L, utf8iteraux);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, 0);
+    return 3;
+}
+
+/* }====================================================== */
+
 /**
  * Table library registration
  */
@@ -1047,6 +2425,8 @@ static const luaL_Reg strlib_shared[] = {
 
 static const luaL_Reg strlib_lua[] = {
     { "dump", str_dump },
+    { "utf8iter", str_utf8iter },
+    { "utf8sub", str_utf8sub },
     /* clang-format off */
     { NULL, NULL },
     /* clang-format on */
@@ -1078,7 +2458,8 @@ static void createmetatable (lua_State *L) {
 
 LUALIB_API int luaopen_string (lua_State *L) {
     luaL_register(L, "_G", strlib_global);
-    luaL_register(L, LUA_STRLIBNAME, strlib_shared);
+    pushpatcache(L);
+    luaL_openlib(L, LUA_STRLIBNAME, strlib_shared, 1);
     luaL_setfuncs(L, strlib_lua, 0);
     createmetatable(L);
     return 1;
@@ -1087,7 +2468,8 @@ LUALIB_API int luaopen_string (lua_State *L) {
 LUALIB_API int luaopen_elune_string (lua_State *L) {
     /* open string library */
     luaL_getsubtable(L, LUA_ENVIRONINDEX, LUA_STRLIBNAME);
-    luaL_setfuncs(L, strlib_shared, 0);
+    pushpatcache(L);
+    luaL_setfuncs(L, strlib_shared, 1);
 
     /* open global functions */
     lua_pushvalue(L, LUA_ENVIRONINDEX);
@@ -12,6 +12,11 @@
 ** in its main position (i.e. the `original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+**
+** If LUA_USE_SWISSTABLE is defined, the hash part instead uses open
+** addressing with a control byte per node that holds 7 bits of the key's
+** hash. Lookups compare a whole group of control bytes at once, and only
+** visit nodes whose tag matches; the load factor is kept below 7/8.
 */
 
 #include <math.h>
@@ -29,7 +34,19 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lstring.h"
 #include "ltable.h"
+#include "lvm.h"
+
+#if defined(LUA_USE_SWISSTABLE)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LUAI_GROUPSSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LUAI_GROUPNEON
+#endif
+#endif
 
 /*
 ** max size of array part is 2^MAXBITS
@@ -60,6 +77,191 @@
 */
 #define numints cast_int(sizeof(lua_Number) / sizeof(int))
 
+/*
+** note a store into slot `k' of `t': the border hint survives stores at
+** the border or just past it, and any other store into the array part
+** discards it
+*/
+#define touchborder(t, k)                                                                                              \
+    {                                                                                                                  \
+        if (cast(unsigned int, (k) - 1) < cast(unsigned int, (t)->sizearray) && (k) != (t)->border &&                  \
+            (k) != (t)->border + 1) {                                                                                  \
+            (t)->border = -1;                                                                                          \
+        }                                                                                                              \
+    }
+
+#if defined(LUA_USE_SWISSTABLE)
+
+#define CTRL_EMPTY 0x80 /* control byte of a free node; used ones hold a tag */
+
+#define hashtag(h) cast_byte((h) & 0x7f)
+#define hashpos(t, h) (((h) >> 7) & cast(unsigned int, sizenode(t) - 1))
+
+static const struct {
+    Node node;
+    lu_byte ctrl[GROUPWIDTH];
+} dummynode_ = {
+    {
+        { { NULL }, NULL, LUA_TNIL }, /* value */
+        { { { NULL }, NULL, LUA_TNIL } } /* key */
+    },
+    { CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY,
+      CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY, CTRL_EMPTY }
+};
+
+#define dummynode (&dummynode_.node)
+
+/*
+** Group matching: `groupmatch' returns a mask with a set bit for each of
+** the GROUPWIDTH control bytes at `g' that equal `b', `groupfirst' the
+** offset within the group of the lowest one, and `groupnext' the mask
+** without it.
+*/
+#if defined(LUAI_GROUPSSE2)
+
+typedef unsigned int GroupMask;
+
+static GroupMask groupmatch (const lu_byte *g, lu_byte b) {
+    __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+    return cast(GroupMask, _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, b)))));
+}
+
+#elif defined(LUAI_GROUPNEON)
+
+typedef uint64_t GroupMask; /* 4 bits per byte; only the top one is kept */
+
+static GroupMask groupmatch (const lu_byte *g, lu_byte b) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8(g), vdupq_n_u8(b));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & UINT64_C(0x8888888888888888);
+}
+
+#else
+
+typedef unsigned int GroupMask;
+
+static GroupMask groupmatch (const lu_byte *g, lu_byte b) {
+    GroupMask m = 0;
+    int i;
+    for (i = 0; i < GROUPWIDTH; i++) {
+        m |= cast(GroupMask, g[i] == b) << i;
+    }
+    return m;
+}
+
+#endif
+
+#define groupnext(m) ((m) & ((m) - 1))
+
+static int groupfirst (GroupMask m) {
+    int i;
+#if defined(__GNUC__) && defined(LUAI_GROUPNEON)
+    i = __builtin_ctzll(m);
+#elif defined(__GNUC__)
+    i = __builtin_ctz(m);
+#else
+    for (i = 0; !(m & 1); i++) {
+        m >>= 1;
+    }
+#endif
+#if defined(LUAI_GROUPNEON)
+    i >>= 2;
+#endif
+    return i;
+}
+
+/*
+** Search `t' for a node `n' that satisfies `cond', among the nodes whose
+** tag matches hash `h'. Groups are probed with growing strides until one
+** holds a free node, since a key is never placed past a free node in its
+** probe sequence; `n' is NULL if no node was found.
+*/
+#define searchnode(t, h, n, cond)                                                                                      \
+    {                                                                                                                  \
+        unsigned int mask_ = cast(unsigned int, sizenode(t) - 1);                                                      \
+        unsigned int pos_ = hashpos(t, h);                                                                             \
+        unsigned int step_ = 0;                                                                                        \
+        unsigned int groups_ = mask_ / GROUPWIDTH + 1;                                                                 \
+        lu_byte tag_ = hashtag(h);                                                                                     \
+        (n) = NULL;                                                                                                    \
+        while (groups_-- > 0) {                                                                                        \
+            const lu_byte *g_ = gctrl(t) + pos_;                                                                       \
+            GroupMask m_;                                                                                              \
+            for (m_ = groupmatch(g_, tag_); m_ != 0; m_ = groupnext(m_)) {                                             \
+                (n) = gnode(t, (pos_ + groupfirst(m_)) & mask_);                                                       \
+                if (cond) {                                                                                            \
+                    break;                                                                                             \
+                }                                                                                                      \
+                (n) = NULL;                                                                                            \
+            }                                                                                                          \
+            if ((n) != NULL || groupmatch(g_, CTRL_EMPTY) != 0) {                                                      \
+                break;                                                                                                 \
+            }                                                                                                          \
+            step_ += GROUPWIDTH;                                                                                       \
+            pos_ = (pos_ + step_) & mask_;                                                                             \
+        }                                                                                                              \
+    }
+
+/*
+** final mix of a 32-bit hash, so that its top bits pick the position and
+** its low bits the tag
+*/
+static unsigned int mixhash (unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/*
+** hash for lua_Numbers
+*/
+static unsigned int numhash (lua_Number n) {
+    unsigned int a[numints];
+    int i;
+    if (luai_numeq(n, 0)) { /* avoid problems with -0 */
+        return mixhash(0);
+    }
+    memcpy(a, &n, sizeof(a));
+    for (i = 1; i < numints; i++) {
+        a[0] += a[i];
+    }
+    return mixhash(a[0]);
+}
+
+static unsigned int hashkey (const TValue *key) {
+    switch (ttype(key)) {
+        case LUA_TNUMBER:
+            return numhash(nvalue(key));
+        case LUA_TSTRING:
+            return mixhash(rawtsvalue(key)->tsv.hash);
+        case LUA_TBOOLEAN:
+            return mixhash(cast(unsigned int, bvalue(key)));
+        case LUA_TLIGHTUSERDATA:
+            return mixhash(IntPoint(pvalue(key)));
+        default:
+            return mixhash(IntPoint(gcvalue(key)));
+    }
+}
+
+#define numhome(t, n) numhash(n)
+#define strhome(t, str) mixhash((str)->tsv.hash)
+#define keyhome(t, key) hashkey(key)
+
+#if defined(LUA_DEBUG)
+/*
+** returns the `main' position of an element in a table (that is, the first
+** node of its probe sequence)
+*/
+static Node *mainposition (const Table *t, const TValue *key) {
+    return gnode(t, hashpos(t, hashkey(key)));
+}
+#endif
+
+#else
+
 #define dummynode (&dummynode_)
 
 static const Node dummynode_ = {
@@ -102,6 +304,24 @@ static Node *mainposition (const Table *t, const TValue *key) {
     }
 }
 
+/*
+** Search the collision chain starting at node `home' for a node `n' that
+** satisfies `cond'; `n' is NULL if no node was found.
+*/
+#define searchnode(t, home, n, cond)                                                                                   \
+    {                                                                                                                  \
+        (n) = (home);                                                                                                  \
+        while ((n) != NULL && !(cond)) {                                                                               \
+            (n) = gnext(n);                                                                                            \
+        }                                                                                                              \
+    }
+
+#define numhome(t, n) hashnum(t, n)
+#define strhome(t, str) hashstr(t, str)
+#define keyhome(t, key) mainposition(t, key)
+
+#endif
+
 /*
 ** returns the index for `key' if `key' is an appropriate key to live in
 ** the array part of the table, -1 otherwise.
@@ -118,12 +338,22 @@ static int arrayindex (const TValue *key) {
     return -1; /* `key' did not match some condition */
 }
 
+/*
+** true if node `n' holds `key' for a table traversal; the key may be dead
+** already, but it is ok to use it in `next'
+*/
+#define istraversalkey(n, key)                                                                                         \
+    (luaO_rawequalObj(key2tval(n), key) ||                                                                             \
+     (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) && gcvalue(gkey(n)) == gcvalue(key)))
+
 /*
 ** returns the index of a `key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signalled by -1.
+** beginning of a traversal is signalled by -1, and a key that is not in
+** the table by -2. The node that `next' returned last is tried before
+** searching for the key.
 */
-static int findindex (lua_State *L, Table *t, StkId key) {
+static int findindex (Table *t, const TValue *key) {
     int i;
     if (ttisnil(key)) {
         return -1; /* first iteration */
@@ -132,24 +362,25 @@ static int findindex (lua_State *L, Table *t, StkId key) {
     if (0 < i && i <= t->sizearray) { /* is `key' inside array part? */
         return i - 1; /* yes; that's the index (corrected to C) */
     } else {
-        Node *n = mainposition(t, key);
-        do { /* check whether `key' is somewhere in the chain */
-            /* key may be dead already, but it is ok to use it in `next' */
-            if (luaO_rawequalObj(key2tval(n), key) ||
-                (ttype(gkey(n)) == LUA_TDEADKEY && iscollectable(key) && gcvalue(gkey(n)) == gcvalue(key))) {
-                i = cast_int(n - gnode(t, 0)); /* key index in hash table */
-                /* hash elements are numbered after array ones */
-                return i + t->sizearray;
-            } else {
-                n = gnext(n);
+        Node *n;
+        if (t->cursor < sizenode(t) && istraversalkey(gnode(t, t->cursor), key)) {
+            n = gnode(t, t->cursor);
+        } else {
+            searchnode(t, keyhome(t, key), n, istraversalkey(n, key));
+            if (n == NULL) {
+                return -2; /* key not found */
             }
-        } while (n);
-        luaG_runerror(L, "invalid key to 'next'"); /* key not found */
+        }
+        i = cast_int(n - gnode(t, 0)); /* key index in hash table */
+        /* hash elements are numbered after array ones */
+        return i + t->sizearray;
     }
 }
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
-    int i = findindex(L, t, key); /* find original element */
+/*
+** store in `key' and `key+1' the first entry of `t' after index `i'
+*/
+static int nextentry (lua_State *L, Table *t, int i, StkId key) {
     for (i++; i < t->sizearray; i++) { /* try first array part */
         if (!ttisnil(&t->array[i])) { /* a non-nil value? */
             setnvalue(L, key, cast_num(i + 1));
@@ -161,12 +392,30 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
         if (!ttisnil(gval(gnode(t, i)))) { /* a non-nil value? */
             setobj2s(L, key, key2tval(gnode(t, i)));
             setobj2s(L, key + 1, gval(gnode(t, i)));
+            t->cursor = i;
             return 1;
         }
     }
     return 0; /* no more elements */
 }
 
+int luaH_next (lua_State *L, Table *t, StkId key) {
+    int i = findindex(t, key); /* find original element */
+    if (i == -2) {
+        luaG_runerror(L, "invalid key to 'next'"); /* key not found */
+    }
+    return nextentry(L, t, i, key);
+}
+
+/*
+** Like `luaH_next', but returns -1 rather than raising an error if `key'
+** is not in the table.
+*/
+int luaH_trynext (lua_State *L, Table *t, StkId key) {
+    int i = findindex(t, key);
+    return (i == -2) ? -1 : nextentry(L, t, i, key);
+}
+
 /*
 ** {=============================================================
 ** Rehash
@@ -256,6 +505,50 @@ static void setarrayvector (lua_State *L, Table *t, int size) {
     t->sizearray = size;
 }
 
+#if defined(LUA_USE_SWISSTABLE)
+
+/*
+** Set the control byte of node `i', and its mirror after the last node if
+** there is one.
+*/
+static void setctrl (Table *t, int i, lu_byte c) {
+    lu_byte *ctrl = gctrl(t);
+    int size = sizenode(t);
+    ctrl[i] = c;
+    for (i += size; i < size + GROUPWIDTH - 1; i += size) {
+        ctrl[i] = c;
+    }
+}
+
+/* number of keys that a hash part of `size' nodes can take */
+#define nodecapacity(size) ((size) - (size) / 8)
+
+static void setnodevector (lua_State *L, Table *t, int size) {
+    if (size == 0) { /* no elements to hash part? */
+        t->node = cast(Node *, dummynode); /* use common `dummynode' */
+        t->lsizenode = 0;
+        t->nodefree = 0;
+    } else {
+        int i;
+        int lsize = ceillog2(size + size / 7); /* keep the load below 7/8 */
+        if (lsize > MAXBITS) {
+            luaG_runerror(L, "table overflow");
+        }
+        size = twoto(lsize);
+        t->node = cast(Node *, luaM_malloc(L, nodebytes(size)));
+        t->lsizenode = cast_byte(lsize);
+        for (i = 0; i < size; i++) {
+            Node *n = gnode(t, i);
+            rawsetnilvalue(key2tval(n));
+            rawsetnilvalue(gval(n));
+        }
+        memset(gctrl(t), CTRL_EMPTY, size + GROUPWIDTH - 1);
+        t->nodefree = nodecapacity(size);
+    }
+}
+
+#else
+
 static void setnodevector (lua_State *L, Table *t, int size) {
     int lsize;
     if (size == 0) { /* no elements to hash part? */
@@ -280,6 +573,26 @@ static void setnodevector (lua_State *L, Table *t, int size) {
     t->lastfree = gnode(t, size); /* all positions are free */
 }
 
+#endif
+
+/*
+** Recompute the border hint of `t': its array part is a gapless sequence
+** if every non-nil value comes before every nil one.
+*/
+static void setborder (Table *t) {
+    int i = 0;
+    while (i < t->sizearray && !ttisnil(&t->array[i])) {
+        i++;
+    }
+    t->border = i;
+    for (; i < t->sizearray; i++) {
+        if (!ttisnil(&t->array[i])) {
+            t->border = -1; /* there is a hole in the array part */
+            return;
+        }
+    }
+}
+
 static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
     int i;
     int oldasize = t->sizearray;
@@ -309,8 +622,13 @@ static void resize (lua_State *L, Table *t, int nasize, int nhsize) {
         }
     }
     if (nold != dummynode) {
-        luaM_freearray(L, nold, twoto(oldhsize), Node); /* free old array */
+        luaM_freemem(L, nold, nodebytes(twoto(oldhsize))); /* free old array */
     }
+    setborder(t);
+}
+
+void luaH_resize (lua_State *L, Table *t, int nasize, int nhsize) {
+    resize(L, t, nasize, nhsize);
 }
 
 void luaH_resizearray (lua_State *L, Table *t, int nasize) {
@@ -318,6 +636,341 @@ void luaH_resizearray (lua_State *L, Table *t, int nasize) {
     resize(L, t, nasize, nsize);
 }
 
+/*
+** Grow `t' so that it can hold at least `nasize' array entries and `nhsize'
+** hash entries without being rehashed. Never shrinks either part.
+*/
+void luaH_reserve (lua_State *L, Table *t, int nasize, int nhsize) {
+    int nsize = (t->node == dummynode) ? 0 : sizenode(t);
+    if (nasize > t->sizearray || nhsize > nsize) {
+        resize(L, t, (nasize > t->sizearray) ? nasize : t->sizearray, (nhsize > nsize) ? nhsize : nsize);
+    }
+}
+
+/*
+** Remove every entry from `t' without releasing its storage. Entries are
+** visited in `next' order, and each one is cleared as if it had been read
+** and then assigned nil: its taint reaches the stack, and the current write
+** taint is applied to the emptied value. Keys stay in their nodes as dead
+** entries, so a traversal in progress can still continue from them.
+*/
+void luaH_wipe (lua_State *L, Table *t) {
+    int i;
+    for (i = 0; i < t->sizearray; i++) {
+        TValue *v = &t->array[i];
+        if (!ttisnil(v)) {
+            luaR_taintstack(L, v->taint);
+            setnilvalue(L, v);
+        }
+    }
+    t->border = 0;
+    if (t->node == dummynode) {
+        return;
+    }
+    for (i = 0; i < sizenode(t); i++) {
+        Node *n = gnode(t, i);
+        if (!ttisnil(gval(n))) {
+            luaR_taintstack(L, key2tval(n)->taint);
+            luaR_taintstack(L, gval(n)->taint);
+            setnilvalue(L, gval(n));
+        }
+    }
+}
+
+/*
+** Copy `src' into `dst' as if it were pushed onto the stack and then
+** stored: a tainted value taints the stack, and an untainted one takes
+** the current write taint.
+*/
+static void moveslot (lua_State *L, Table *t, TValue *dst, const TValue *src) {
+    TValue v = *src;
+    if (v.taint == NULL) {
+        v.taint = L->writetaint;
+    } else {
+        luaR_taintstack(L, v.taint);
+    }
+    setobj(L, dst, &v);
+    luaC_barriert(L, t, &v);
+}
+
+/*
+** Copy src[f..e] into dst[d..d+e-f] with raw accesses, element by element
+** in the order that keeps overlapping ranges of one table intact. Ranges
+** that lie within both array parts are moved without any lookups.
+*/
+void luaH_move (lua_State *L, Table *src, int f, int e, Table *dst, int d) {
+    int i;
+    int backward = (src == dst && d > f && d <= e);
+    if (e < f) {
+        return;
+    } else if (f >= 1 && e <= src->sizearray && d >= 1 && d + (e - f) <= dst->sizearray) {
+        TValue *from = &src->array[f - 1];
+        TValue *to = &dst->array[d - 1];
+        if (backward) {
+            for (i = e - f; i >= 0; i--) {
+                touchborder(dst, d + i);
+                moveslot(L, dst, &to[i], &from[i]);
+            }
+        } else {
+            for (i = 0; i <= e - f; i++) {
+                touchborder(dst, d + i);
+                moveslot(L, dst, &to[i], &from[i]);
+            }
+        }
+    } else if (backward) {
+        for (i = e - f; i >= 0; i--) {
+            TValue v = *luaH_getnum(src, f + i); /* `dst' may be resized */
+            moveslot(L, dst, luaH_setnum(L, dst, d + i), &v);
+        }
+    } else {
+        for (i = 0; i <= e - f; i++) {
+            TValue v = *luaH_getnum(src, f + i);
+            moveslot(L, dst, luaH_setnum(L, dst, d + i), &v);
+        }
+    }
+}
+
+/*
+** Copy every entry of `src' into the empty table `dst', which is first
+** sized to hold them all. Values are copied as `luaH_move' copies them,
+** while keys are stored untainted like any new key.
+*/
+void luaH_clone (lua_State *L, Table *dst, Table *src) {
+    int i;
+    int nhsize = 0;
+    lua_assert(dst->sizearray == 0 && dst->node == dummynode);
+    for (i = 0; i < sizenode(src); i++) {
+        if (!ttisnil(gval(gnode(src, i)))) {
+            nhsize++;
+        }
+    }
+    if (src->sizearray > 0 || nhsize > 0) {
+        resize(L, dst, src->sizearray, nhsize);
+    }
+    for (i = 0; i < src->sizearray; i++) {
+        if (!ttisnil(&src->array[i])) {
+            moveslot(L, dst, &dst->array[i], &src->array[i]);
+        }
+    }
+    for (i = 0; i < sizenode(src); i++) {
+        Node *n = gnode(src, i);
+        if (!ttisnil(gval(n))) {
+            moveslot(L, dst, luaH_set(L, dst, key2tval(n)), gval(n));
+        }
+    }
+    dst->border = src->border;
+}
+
+/*
+** Create the string formed by t[i..j], which must all be strings or
+** numbers, with `sep' between each pair. The values are measured first so
+** that the result is written straight into a string of the right size, and
+** read as the table library would read them, so their taint still reaches
+** the stack. Returns NULL if any value is of another type.
+*/
+TString *luaH_concat (lua_State *L, Table *t, int i, int j, const char *sep, size_t lsep) {
+    char s[LUAI_MAXNUMBER2STR];
+    TString *ts;
+    char *buff;
+    size_t tl = 0;
+    int k;
+    if (i > j) {
+        return luaS_newliteral(L, "");
+    }
+    for (k = i;; k++) { /* collect total length */
+        const TValue *v = luaH_getnum(t, k);
+        size_t l;
+        if (ttisstring(v)) {
+            l = tsvalue(v)->len;
+        } else if (ttisnumber(v)) {
+            l = luaO_num2str(s, nvalue(v));
+        } else {
+            return NULL;
+        }
+        luaR_taintstack(L, v->taint);
+        l += (k > i) ? lsep : 0;
+        if (l >= LUA_SIZE_MAX - tl) {
+            luaG_runerror(L, "string length overflow");
+        }
+        tl += l;
+        if (k == j) {
+            break;
+        }
+    }
+    ts = luaS_prepare(L, tl); /* emergency collections run no finalizers to change `t' */
+    buff = cast(char *, ts + 1);
+    for (k = i;; k++) {
+        const TValue *v = luaH_getnum(t, k);
+        const char *str;
+        size_t l;
+        if (k > i) {
+            memcpy(buff, sep, lsep);
+            buff += lsep;
+        }
+        if (ttisstring(v)) {
+            str = svalue(v);
+            l = tsvalue(v)->len;
+        } else {
+            l = luaO_num2str(s, nvalue(v));
+            str = s;
+        }
+        memcpy(buff, str, l);
+        buff += l;
+        if (k == j) {
+            break;
+        }
+    }
+    return luaS_intern(L, ts);
+}
+
+/*
+** {=============================================================
+** Array sorting
+** ==============================================================
+*/
+
+#define sortlt(isnum, a, b)                                                                                            \
+    ((isnum) ? luai_numlt(nvalue(a), nvalue(b))                                                                       \
+             : (rawtsvalue(a) != rawtsvalue(b) && luaV_strcmp(rawtsvalue(a), rawtsvalue(b)) < 0))
+
+#define sortswap(a, b)                                                                                                 \
+    {                                                                                                                  \
+        TValue temp_ = *(a);                                                                                           \
+        *(a) = *(b);                                                                                                   \
+        *(b) = temp_;                                                                                                  \
+    }
+
+static void insertionsort (TValue *a, int lo, int up, int isnum) {
+    int i;
+    for (i = lo + 1; i <= up; i++) {
+        TValue v = a[i];
+        int j = i - 1;
+        while (j >= lo && sortlt(isnum, &v, &a[j])) {
+            a[j + 1] = a[j];
+            j--;
+        }
+        a[j + 1] = v;
+    }
+}
+
+static void siftdown (TValue *a, int root, int n, int isnum) {
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && sortlt(isnum, &a[child], &a[child + 1])) {
+            child++;
+        }
+        if (!sortlt(isnum, &a[root], &a[child])) {
+            break;
+        }
+        sortswap(&a[root], &a[child]);
+        root = child;
+    }
+}
+
+static void heapsort (TValue *a, int n, int isnum) {
+    int i;
+    for (i = n / 2 - 1; i >= 0; i--) {
+        siftdown(a, i, n, isnum);
+    }
+    for (i = n - 1; i > 0; i--) {
+        sortswap(&a[0], &a[i]);
+        siftdown(a, 0, i, isnum);
+    }
+}
+
+/*
+** Introsort: quicksort with a median-of-three pivot that falls back to
+** heapsort once `depth' runs out, so the worst case stays O(n log n).
+*/
+static void introsort (TValue *a, int lo, int up, int depth, int isnum) {
+    while (up - lo > LUAI_SORTTHRESHOLD) {
+        int i;
+        int j;
+        int p = lo + (up - lo) / 2;
+        if (depth-- == 0) {
+            heapsort(a + lo, up - lo + 1, isnum);
+            return;
+        }
+        /* order a[lo], a[p] and a[up], then use a[p] as pivot */
+        if (sortlt(isnum, &a[up], &a[lo])) {
+            sortswap(&a[lo], &a[up]);
+        }
+        if (sortlt(isnum, &a[p], &a[lo])) {
+            sortswap(&a[p], &a[lo]);
+        } else if (sortlt(isnum, &a[up], &a[p])) {
+            sortswap(&a[p], &a[up]);
+        }
+        sortswap(&a[p], &a[up - 1]);
+        p = up - 1;
+        /* a[lo] <= P == a[up-1] <= a[up], only need to sort from lo+1 to up-2 */
+        i = lo;
+        j = up - 1;
+        for (;;) {
+            do { /* repeat ++i until a[i] >= P */
+                i++;
+            } while (sortlt(isnum, &a[i], &a[p]));
+            do { /* repeat --j until a[j] <= P */
+                j--;
+            } while (sortlt(isnum, &a[p], &a[j]));
+            if (j < i) {
+                break;
+            }
+            sortswap(&a[i], &a[j]);
+        }
+        sortswap(&a[up - 1], &a[i]);
+        /* recurse into the smaller half, loop on the larger one */
+        if (i - lo < up - i) {
+            introsort(a, lo, i - 1, depth, isnum);
+            lo = i + 1;
+        } else {
+            introsort(a, i + 1, up, depth, isnum);
+            up = i - 1;
+        }
+    }
+    insertionsort(a, lo, up, isnum);
+}
+
+/*
+** Sort t[1..n] in place by primitive `<' when every value lives in the
+** array part and all of them are numbers (none NaN) or all are strings.
+** Values are read as the table library would read them, so their taint
+** still reaches the stack; if that leaves a write taint that moved values
+** would pick up, nothing is sorted. Returns 0 if `t' was left untouched.
+*/
+int luaH_sort (lua_State *L, Table *t, int n) {
+    int i;
+    int isnum;
+    int depth = 0;
+    if (n < 2) {
+        return 1; /* nothing to do */
+    } else if (n > t->sizearray) {
+        return 0;
+    }
+    isnum = ttisnumber(&t->array[0]);
+    for (i = 0; i < n; i++) {
+        const TValue *v = &t->array[i];
+        if (isnum ? (!ttisnumber(v) || luai_numisnan(nvalue(v))) : !ttisstring(v)) {
+            return 0;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        luaR_taintstack(L, t->array[i].taint);
+    }
+    if (L->writetaint != NULL) {
+        return 0;
+    }
+    for (i = n; i > 0; i >>= 1) {
+        depth += 2; /* 2 * log2(n) */
+    }
+    introsort(t->array, 0, n - 1, depth, isnum);
+    return 1;
+}
+
+/* }============================================================= */
+
 static void rehash (lua_State *L, Table *t, const TValue *ek) {
     int nasize;
     int na;
@@ -330,42 +983,107 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
     nasize = numusearray(t, nums); /* count keys in array part */
     totaluse = nasize; /* all those keys are integer keys */
     totaluse += numusehash(t, nums, &nasize); /* count keys in hash part */
-    /* count extra key */
-    nasize += countint(ek, nums);
-    totaluse++;
+    if (ek != NULL) { /* count extra key */
+        nasize += countint(ek, nums);
+        totaluse++;
+    }
     /* compute new size for array part */
     na = computesizes(nums, &nasize);
     /* resize the table to new computed sizes */
     resize(L, t, nasize, totaluse - na);
 }
 
+/*
+** Resize both parts of `t' to the smallest sizes that fit its current
+** contents, as a rehash would.
+*/
+void luaH_compact (lua_State *L, Table *t) {
+    rehash(L, t, NULL);
+}
+
 /*
 ** }=============================================================
 */
 
-Table *luaH_new (lua_State *L, int narray, int nhash) {
+Table *luaH_new (lua_State *L) {
     Table *t = luaM_new(L, Table);
     luaC_link(L, obj2gco(t), LUA_TTABLE);
     t->metatable = NULL;
     t->flags = cast_byte(~0);
-    /* temporary values (kept only if some malloc fails) */
+    /* new tables start empty; callers anchor them before `luaH_resize' */
     t->array = NULL;
     t->sizearray = 0;
+    t->border = 0;
+    t->cursor = 0;
     t->lsizenode = 0;
     t->node = cast(Node *, dummynode);
-    setarrayvector(L, t, narray);
-    setnodevector(L, t, nhash);
+#if defined(LUA_USE_SWISSTABLE)
+    t->nodefree = 0;
+#else
+    t->lastfree = gnode(t, 0); /* no free positions */
+#endif
     return t;
 }
 
 void luaH_free (lua_State *L, Table *t) {
     if (t->node != dummynode) {
-        luaM_freearray(L, t->node, sizenode(t), Node);
+        luaM_freemem(L, t->node, nodebytes(sizenode(t)));
     }
     luaM_freearray(L, t->array, t->sizearray, TValue);
     luaM_free(L, t);
 }
 
+#if defined(LUA_USE_SWISSTABLE)
+
+/*
+** inserts a new key into a hash table, at the first free node of its probe
+** sequence; the table is rehashed when it has no room left for the key.
+** If the collector left a dead key for the same object on the way there,
+** that node is reused instead: `next' must not find a stale copy of a key
+** before its live one.
+*/
+static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
+    unsigned int h = hashkey(key);
+    unsigned int mask = cast(unsigned int, sizenode(t) - 1);
+    unsigned int pos = hashpos(t, h);
+    unsigned int step = 0;
+    GroupMask m;
+    Node *n = NULL;
+    if (t->nodefree == 0) { /* cannot take another key? */
+        rehash(L, t, key); /* grow table */
+        return luaH_set(L, t, key); /* re-insert key into grown table */
+    }
+    for (;;) {
+        const lu_byte *g = gctrl(t) + pos;
+        if (iscollectable(key)) {
+            for (m = groupmatch(g, hashtag(h)); m != 0; m = groupnext(m)) {
+                n = gnode(t, (pos + groupfirst(m)) & mask);
+                if (ttype(gkey(n)) == LUA_TDEADKEY && gcvalue(gkey(n)) == gcvalue(key)) {
+                    break;
+                }
+                n = NULL;
+            }
+        }
+        if (n != NULL) {
+            break; /* revive dead key */
+        } else if ((m = groupmatch(g, CTRL_EMPTY)) != 0) {
+            n = gnode(t, (pos + groupfirst(m)) & mask);
+            setctrl(t, cast_int(n - gnode(t, 0)), hashtag(h));
+            t->nodefree--;
+            break;
+        }
+        step += GROUPWIDTH;
+        pos = (pos + step) & mask;
+    }
+    lua_assert(n != dummynode);
+    rawsetobj(L, key2tval(n), key);
+    luaC_barriert(L, t, key);
+    lua_assert(ttisnil(gval(n)));
+    return gval(n);
+}
+
+#else
+
 static Node *getfreepos (Table *t) {
     while (t->lastfree-- > t->node) {
         if (ttisnil(gkey(t->lastfree))) {
@@ -415,6 +1133,8 @@ static TValue *newkey (lua_State *L, Table *t, const TValue *key) {
     return gval(mp);
 }
 
+#endif
+
 /*
 ** search function for integers
 */
@@ -424,15 +1144,9 @@ const TValue *luaH_getnum (Table *t, int key) {
         return &t->array[key - 1];
     } else {
         lua_Number nk = cast_num(key);
-        Node *n = hashnum(t, nk);
-        do { /* check whether `key' is somewhere in the chain */
-            if (ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk)) {
-                return gval(n); /* that's it */
-            } else {
-                n = gnext(n);
-            }
-        } while (n);
-        return luaO_nilobject;
+        Node *n;
+        searchnode(t, numhome(t, nk), n, ttisnumber(gkey(n)) && luai_numeq(nvalue(gkey(n)), nk));
+        return (n != NULL) ? gval(n) : luaO_nilobject;
     }
 }
 
@@ -440,14 +1154,30 @@ const TValue *luaH_getnum (Table *t, int key) {
 ** search function for strings
 */
 const TValue *luaH_getstr (Table *t, TString *key) {
-    Node *n = hashstr(t, key);
-    do { /* check whether `key' is somewhere in the chain */
+    Node *n;
+    searchnode(t, strhome(t, key), n, ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key);
+    return (n != NULL) ? gval(n) : luaO_nilobject;
+}
+
+/*
+** search function for strings, trying first the node at `*hint' and
+** storing there the node where the key was found otherwise; tables
+** filled with the same keys in the same order share their layout, so a
+** hint kept per call site usually holds across all of them
+*/
+const TValue *luaH_getstrhint (Table *t, TString *key, int *hint) {
+    Node *n;
+    if (*hint < sizenode(t)) {
+        n = gnode(t, *hint);
         if (ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key) {
-            return gval(n); /* that's it */
-        } else {
-            n = gnext(n);
+            return gval(n);
         }
-    } while (n);
+    }
+    searchnode(t, strhome(t, key), n, ttisstring(gkey(n)) && rawtsvalue(gkey(n)) == key);
+    if (n != NULL) {
+        *hint = cast_int(n - gnode(t, 0));
+        return gval(n);
+    }
     return luaO_nilobject;
 }
 
@@ -471,15 +1201,9 @@ const TValue *luaH_get (Table *t, const TValue *key) {
             LUA_FALLTHROUGH;
         }
         default: {
-            Node *n = mainposition(t, key);
-            do { /* check whether `key' is somewhere in the chain */
-                if (luaO_rawequalObj(key2tval(n), key)) {
-                    return gval(n); /* that's it */
-                } else {
-                    n = gnext(n);
-                }
-            } while (n);
-            return luaO_nilobject;
+            Node *n;
+            searchnode(t, keyhome(t, key), n, luaO_rawequalObj(key2tval(n), key));
+            return (n != NULL) ? gval(n) : luaO_nilobject;
         }
     }
 }
@@ -488,6 +1212,14 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
     const TValue *p = luaH_get(t, key);
     t->flags = 0;
     if (p != luaO_nilobject) {
+        if (ttisnumber(key)) {
+            int k;
+            lua_Number n = nvalue(key);
+            lua_number2int(k, n);
+            if (luai_numeq(cast_num(k), n)) {
+                touchborder(t, k);
+            }
+        }
         return cast(TValue *, p);
     } else {
         if (ttisnil(key)) {
@@ -502,6 +1234,7 @@ TValue *luaH_set (lua_State *L, Table *t, const TValue *key) {
 TValue *luaH_setnum (lua_State *L, Table *t, int key) {
     const TValue *p = luaH_getnum(t, key);
     if (p != luaO_nilobject) {
+        touchborder(t, key);
         return cast(TValue *, p);
     } else {
         TValue k;
@@ -521,6 +1254,16 @@ TValue *luaH_setstr (lua_State *L, Table *t, TString *key) {
     }
 }
 
+TValue *luaH_setstrhint (lua_State *L, Table *t, const TValue *key, int *hint) {
+    const TValue *p = luaH_getstrhint(t, rawtsvalue(key), hint);
+    t->flags = 0;
+    if (p != luaO_nilobject) {
+        return cast(TValue *, p);
+    } else {
+        return newkey(L, t, key);
+    }
+}
+
 static int unbound_search (Table *t, unsigned int j) {
     unsigned int i = j; /* i is zero or a present index */
     j++;
@@ -549,6 +1292,34 @@ static int unbound_search (Table *t, unsigned int j) {
     return i;
 }
 
+/*
+** Bring the border hint of `t' up to date. Since it was last checked only
+** the slots on either side of it can have changed, so the new border is
+** one step away at most; a nil below a non-nil value leaves a hole and
+** discards the hint.
+*/
+static int checkborder (Table *t) {
+    int b = t->border;
+    int below;
+    int above;
+    if (b < 0) {
+        return -1;
+    }
+    below = (b == 0 || !ttisnil(&t->array[b - 1]));
+    above = (b < t->sizearray && !ttisnil(&t->array[b]));
+    if (below && !above) {
+        return b;
+    } else if (below) {
+        b++; /* value appended */
+    } else if (!above) {
+        b--; /* last value removed */
+    } else {
+        b = -1;
+    }
+    t->border = b;
+    return b;
+}
+
 /*
 ** Try to find a boundary in table `t'. A `boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
@@ -558,6 +1329,10 @@ int luaH_getn (Table *t) {
     if (j > 0 && ttisnil(&t->array[j - 1])) {
         /* there is a boundary in the array part: (binary) search for it */
         unsigned int i = 0;
+        int b = checkborder(t);
+        if (b >= 0) {
+            return b; /* the only boundary of a gapless array part */
+        }
         while (j - i > 1) {
             unsigned int m = (i + j) / 2;
             if (ttisnil(&t->array[m - 1])) {
@@ -9,7 +9,20 @@
 #define gnode(t, i) (&(t)->node[i])
 #define gkey(n) (&(n)->i_key.nk)
 #define gval(n) (&(n)->i_val)
+
+#if defined(LUA_USE_SWISSTABLE)
+/*
+** Control bytes follow the nodes in the same block; the first GROUPWIDTH-1
+** of them are mirrored after the last so that every group load stays in
+** bounds.
+*/
+#define GROUPWIDTH 16
+#define gctrl(t) (cast(lu_byte *, (t)->node + sizenode(t)))
+#define nodebytes(size) ((size) * sizeof(Node) + (size) + GROUPWIDTH - 1)
+#else
 #define gnext(n) ((n)->i_key.nk.next)
+#define nodebytes(size) ((size) * sizeof(Node))
+#endif
 
 #define key2tval(n) (&(n)->i_key.tvk)
 
@@ -17,12 +30,23 @@ LUAI_FUNC const TValue *luaH_getnum (Table *t, int key);
 LUAI_FUNC TValue *luaH_setnum (lua_State *L, Table *t, int key);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC TValue *luaH_setstr (lua_State *L, Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getstrhint (Table *t, TString *key, int *hint);
+LUAI_FUNC TValue *luaH_setstrhint (lua_State *L, Table *t, const TValue *key, int *hint);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set (lua_State *L, Table *t, const TValue *key);
-LUAI_FUNC Table *luaH_new (lua_State *L, int narray, int lnhash);
+LUAI_FUNC Table *luaH_new (lua_State *L);
+LUAI_FUNC void luaH_resize (lua_State *L, Table *t, int nasize, int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, int nasize);
+LUAI_FUNC void luaH_reserve (lua_State *L, Table *t, int nasize, int nhsize);
+LUAI_FUNC void luaH_compact (lua_State *L, Table *t);
+LUAI_FUNC void luaH_wipe (lua_State *L, Table *t);
+LUAI_FUNC void luaH_clone (lua_State *L, Table *dst, Table *src);
+LUAI_FUNC void luaH_move (lua_State *L, Table *src, int f, int e, Table *dst, int d);
+LUAI_FUNC TString *luaH_concat (lua_State *L, Table *t, int i, int j, const char *sep, size_t lsep);
+LUAI_FUNC int luaH_sort (lua_State *L, Table *t, int n);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC int luaH_trynext (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 
 #if defined(LUA_DEBUG)
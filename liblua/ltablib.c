@@ -1,7 +1,9 @@
 /* Licensed under the terms of the MIT License; see full copyright information
  * in the "LICENSE" file or at <http://www.lua.org/license.html> */
 
+#include <limits.h>
 #include <stddef.h>
+#include <time.h>
 
 #define ltablib_c
 #define LUA_LIB
@@ -83,15 +85,11 @@ static int table_insert (lua_State *L) {
             break;
         }
         case 3: {
-            int i;
             pos = luaL_checkint(L, 2); /* 2nd argument is the position */
             if (pos > e) {
                 e = pos; /* `grow' array if necessary */
             }
-            for (i = e; i > pos; i--) { /* move up elements */
-                lua_rawgeti(L, 1, i - 1);
-                lua_rawseti(L, 1, i); /* t[i] = t[i-1] */
-            }
+            lua_rawmove(L, 1, pos, e - 1, pos + 1, 1); /* t[pos+1..e] = t[pos..e-1] */
             break;
         }
         default: {
@@ -109,10 +107,7 @@ static int table_remove (lua_State *L) {
         return 0; /* nothing to remove */
     }
     lua_rawgeti(L, 1, pos); /* result = t[pos] */
-    for (; pos < e; pos++) {
-        lua_rawgeti(L, 1, pos + 1);
-        lua_rawseti(L, 1, pos); /* t[pos] = t[pos+1] */
-    }
+    lua_rawmove(L, 1, pos + 1, e, pos, 1); /* t[pos..e-1] = t[pos+1..e] */
     lua_pushnil(L);
     lua_rawseti(L, 1, e); /* t[e] = nil */
     return 1;
@@ -135,6 +130,9 @@ static int table_concat (lua_State *L) {
     luaL_checktype(L, 1, LUA_TTABLE);
     i = luaL_optint(L, 3, 1);
     last = luaL_opt(L, luaL_checkint, 4, (int) lua_objlen(L, 1));
+    if (lua_rawconcat(L, 1, i, last, sep, lsep)) {
+        return 1; /* all values were strings or numbers */
+    }
     luaL_buffinit(L, &b);
     for (; i < last; i++) {
         addfield(L, &b, i);
@@ -174,7 +172,29 @@ static int sort_comp (lua_State *L, int a, int b) {
     }
 }
 
-static void auxsort (lua_State *L, int l, int u) {
+/* partitions larger than this may use a randomized pivot */
+#define SORT_RANLIMIT 100
+
+/*
+** Produce a seed for pivot randomization; only used once a partition has
+** proven badly unbalanced, so ordinary inputs sort deterministically.
+*/
+static unsigned int sort_randomizepivot (void) {
+    unsigned int c = (unsigned int) clock();
+    unsigned int t = (unsigned int) time(NULL);
+    return (c ^ (t << 16) ^ (t >> 16)) | 1;
+}
+
+static int sort_choosepivot (int l, int u, unsigned int rnd) {
+    if (rnd == 0 || u - l < SORT_RANLIMIT) {
+        return (l + u) / 2;
+    } else { /* pick a random index in the middle half of [l, u] */
+        unsigned int r4 = (unsigned int) (u - l) / 4;
+        return (int) (rnd % (r4 * 2)) + (l + (int) r4);
+    }
+}
+
+static void auxsort (lua_State *L, int l, int u, unsigned int rnd) {
     while (l < u) { /* for tail recursion */
         int i;
         int j;
@@ -189,7 +209,7 @@ static void auxsort (lua_State *L, int l, int u) {
         if (u - l == 1) {
             break; /* only 2 elements */
         }
-        i = (l + u) / 2;
+        i = sort_choosepivot(l, u, rnd);
         lua_rawgeti(L, 1, i);
         lua_rawgeti(L, 1, l);
         if (sort_comp(L, -2, -1)) { /* a[i]<a[l]? */
@@ -248,7 +268,10 @@ static void auxsort (lua_State *L, int l, int u) {
             i = u;
             u = j - 2;
         }
-        auxsort(L, j, i); /* call recursively the smaller one */
+        if ((u - l) / 128 > i - j) { /* partition too unbalanced? */
+            rnd = sort_randomizepivot(); /* guard against quadratic inputs */
+        }
+        auxsort(L, j, i, rnd); /* call recursively the smaller one */
     } /* repeat the routine for the larger one */
 }
 
@@ -259,23 +282,467 @@ static int table_sort (lua_State *L) {
         luaL_checktype(L, 2, LUA_TFUNCTION);
     }
     lua_settop(L, 2); /* make sure there is two arguments */
-    auxsort(L, 1, n);
+    if (!lua_isnil(L, 2) || !lua_rawsort(L, 1, n)) { /* no primitive fast path? */
+        auxsort(L, 1, n, 0);
+    }
     return 0;
 }
 
+/*
+** {======================================================
+** Stable merge sort
+** (TimSort, after Tim Peters' `listsort.txt'; the table
+**  is at index 1, the comparator or nil at index 2 and
+**  the merge buffer at index 3. Merges leave holes in the
+**  table while elements wait in the buffer, so the sort
+**  runs protected and refills them if the comparator errs)
+*/
+
+/* runs shorter than this are extended with a binary insertion sort */
+#define TIMSORT_MINMERGE 32
+
+/* enough pending runs for any sequence indexable by an int */
+#define TIMSORT_MAXRUNS 49
+
+typedef struct TimSort {
+    int n; /* number of pending runs */
+    int base[TIMSORT_MAXRUNS]; /* first index of each pending run */
+    int len[TIMSORT_MAXRUNS]; /* length of each pending run */
+    int buflo, bufhi; /* buffer slice not yet written back by a merge */
+    int hole; /* where that slice belongs in the table */
+} TimSort;
+
+/* is t[i] < t[j]? */
+static int timsort_lt (lua_State *L, int i, int j) {
+    int res;
+    lua_rawgeti(L, 1, i);
+    lua_rawgeti(L, 1, j);
+    res = sort_comp(L, -2, -1);
+    lua_pop(L, 2);
+    return res;
+}
+
+/* is the value on top of the stack < t[i]? */
+static int timsort_keylt (lua_State *L, int i) {
+    int res;
+    lua_rawgeti(L, 1, i);
+    res = sort_comp(L, -2, -1);
+    lua_pop(L, 1);
+    return res;
+}
+
+/* is t[i] < the value on top of the stack? */
+static int timsort_ltkey (lua_State *L, int i) {
+    int res;
+    lua_rawgeti(L, 1, i);
+    res = sort_comp(L, -1, -2);
+    lua_pop(L, 1);
+    return res;
+}
+
+static void timsort_move (lua_State *L, int from, int fromidx, int to, int toidx) {
+    lua_rawgeti(L, from, fromidx);
+    lua_rawseti(L, to, toidx);
+}
+
+static int timsort_minrun (int n) {
+    int r = 0; /* becomes 1 if any bits are shifted off */
+    while (n >= TIMSORT_MINMERGE) {
+        r |= (n & 1);
+        n >>= 1;
+    }
+    return n + r;
+}
+
+/*
+** Sort t[lo..hi) given that t[lo..start) is already sorted. Each element
+** is placed after any equal ones, keeping the sort stable.
+*/
+static void timsort_insertion (lua_State *L, int lo, int hi, int start) {
+    for (; start < hi; start++) {
+        int l = lo;
+        int r = start;
+        int k;
+        lua_rawgeti(L, 1, start); /* pivot */
+        while (l < r) {
+            int m = l + (r - l) / 2;
+            if (timsort_keylt(L, m)) {
+                r = m;
+            } else {
+                l = m + 1;
+            }
+        }
+        for (k = start; k > l; k--) {
+            timsort_move(L, 1, k - 1, 1, k);
+        }
+        lua_rawseti(L, 1, l);
+    }
+}
+
+/*
+** Return the length of the run starting at `lo', reversing it first if it
+** is strictly descending (a non-strict one could reorder equal elements).
+*/
+static int timsort_countrun (lua_State *L, int lo, int hi) {
+    int runhi = lo + 1;
+    if (runhi == hi) {
+        return 1;
+    }
+    if (timsort_lt(L, runhi, lo)) { /* descending? */
+        int i = lo;
+        int j;
+        while (runhi + 1 < hi && timsort_lt(L, runhi + 1, runhi)) {
+            runhi++;
+        }
+        for (j = runhi; i < j; i++, j--) {
+            lua_rawgeti(L, 1, i);
+            lua_rawgeti(L, 1, j);
+            lua_rawseti(L, 1, i);
+            lua_rawseti(L, 1, j);
+        }
+    } else {
+        while (runhi + 1 < hi && !timsort_lt(L, runhi + 1, runhi)) {
+            runhi++;
+        }
+    }
+    return runhi + 1 - lo;
+}
+
+/*
+** Find how many elements of t[base..base+len) are <= the value on top of
+** the stack, galloping forward from the start of the run.
+*/
+static int timsort_gallopright (lua_State *L, int base, int len) {
+    int last = 0;
+    int ofs = 1;
+    if (timsort_keylt(L, base)) {
+        return 0;
+    }
+    while (ofs < len && !timsort_keylt(L, base + ofs)) { /* t[base+ofs] <= key */
+        last = ofs;
+        ofs = (ofs << 1) + 1;
+    }
+    if (ofs > len) {
+        ofs = len;
+    }
+    last++; /* t[base+last-1] <= key; key < t[base+ofs] (if ofs < len) */
+    while (last < ofs) {
+        int m = last + (ofs - last) / 2;
+        if (timsort_keylt(L, base + m)) {
+            ofs = m;
+        } else {
+            last = m + 1;
+        }
+    }
+    return ofs;
+}
+
+/*
+** Find how many elements of t[base..base+len) are < the value on top of
+** the stack, galloping backward from the end of the run.
+*/
+static int timsort_gallopleft (lua_State *L, int base, int len) {
+    int last = 0;
+    int ofs = 1;
+    int lo;
+    int hi;
+    if (timsort_ltkey(L, base + len - 1)) {
+        return len;
+    }
+    while (ofs < len && !timsort_ltkey(L, base + len - 1 - ofs)) { /* t[...] >= key */
+        last = ofs;
+        ofs = (ofs << 1) + 1;
+    }
+    if (ofs > len) {
+        ofs = len;
+    }
+    lo = len - ofs; /* t[base+lo-1] < key (if lo > 0) */
+    hi = len - 1 - last; /* key <= t[base+hi] */
+    while (lo < hi) {
+        int m = lo + (hi - lo) / 2;
+        if (timsort_ltkey(L, base + m)) {
+            lo = m + 1;
+        } else {
+            hi = m;
+        }
+    }
+    return hi;
+}
+
+/* merge t[base1..base1+len1) and the following run, len1 <= len2 */
+static void timsort_mergelo (lua_State *L, TimSort *ts, int base1, int len1, int base2, int len2) {
+    int j = base2;
+    int k;
+    for (k = 0; k < len1; k++) {
+        timsort_move(L, 1, base1 + k, 3, k + 1);
+    }
+    ts->buflo = 1; /* buffer[buflo..len1] belongs at t[hole..] */
+    ts->bufhi = len1;
+    ts->hole = base1;
+    while (ts->buflo <= len1 && j < base2 + len2) {
+        lua_rawgeti(L, 3, ts->buflo);
+        if (timsort_ltkey(L, j)) { /* take from the right only if strictly less */
+            lua_pop(L, 1);
+            timsort_move(L, 1, j++, 1, ts->hole++);
+        } else {
+            lua_rawseti(L, 1, ts->hole++);
+            ts->buflo++;
+        }
+    }
+    while (ts->buflo <= len1) {
+        timsort_move(L, 3, ts->buflo++, 1, ts->hole++);
+    }
+}
+
+/* merge t[base1..base1+len1) and the following run, len1 > len2 */
+static void timsort_mergehi (lua_State *L, TimSort *ts, int base1, int len1, int base2, int len2) {
+    int j = base1 + len1 - 1;
+    int k;
+    for (k = 0; k < len2; k++) {
+        timsort_move(L, 1, base2 + k, 3, k + 1);
+    }
+    ts->buflo = 1; /* buffer[1..bufhi] belongs at t[hole..] */
+    ts->bufhi = len2;
+    ts->hole = base2;
+    while (ts->bufhi >= 1 && j >= base1) {
+        lua_rawgeti(L, 3, ts->bufhi);
+        if (timsort_keylt(L, j)) { /* take from the left only if strictly greater */
+            lua_pop(L, 1);
+            timsort_move(L, 1, j--, 1, ts->hole + ts->bufhi - 1);
+            ts->hole--;
+        } else {
+            lua_rawseti(L, 1, ts->hole + ts->bufhi - 1);
+            ts->bufhi--;
+        }
+    }
+    while (ts->bufhi >= 1) {
+        timsort_move(L, 3, ts->bufhi, 1, ts->hole + ts->bufhi - 1);
+        ts->bufhi--;
+    }
+}
+
+/* merge pending runs `i' and `i+1' */
+static void timsort_mergeat (lua_State *L, TimSort *ts, int i) {
+    int base1 = ts->base[i];
+    int len1 = ts->len[i];
+    int base2 = ts->base[i + 1];
+    int len2 = ts->len[i + 1];
+    int k;
+    ts->len[i] = len1 + len2;
+    if (i == ts->n - 3) { /* keep the run after the merged pair */
+        ts->base[i + 1] = ts->base[i + 2];
+        ts->len[i + 1] = ts->len[i + 2];
+    }
+    ts->n--;
+    /* elements of run 1 that are <= run 2's first are already in place */
+    lua_rawgeti(L, 1, base2);
+    k = timsort_gallopright(L, base1, len1);
+    lua_pop(L, 1);
+    base1 += k;
+    len1 -= k;
+    if (len1 == 0) {
+        return;
+    }
+    /* elements of run 2 that are >= run 1's last are already in place */
+    lua_rawgeti(L, 1, base1 + len1 - 1);
+    len2 = timsort_gallopleft(L, base2, len2);
+    lua_pop(L, 1);
+    if (len2 == 0) {
+        return;
+    }
+    if (len1 <= len2) {
+        timsort_mergelo(L, ts, base1, len1, base2, len2);
+    } else {
+        timsort_mergehi(L, ts, base1, len1, base2, len2);
+    }
+}
+
+/* merge pending runs until their lengths satisfy the TimSort invariants */
+static void timsort_collapse (lua_State *L, TimSort *ts) {
+    while (ts->n > 1) {
+        int k = ts->n - 2;
+        if ((k > 0 && ts->len[k - 1] <= ts->len[k] + ts->len[k + 1]) ||
+            (k > 1 && ts->len[k - 2] <= ts->len[k - 1] + ts->len[k])) {
+            if (ts->len[k - 1] < ts->len[k + 1]) {
+                k--;
+            }
+        } else if (ts->len[k] > ts->len[k + 1]) {
+            break; /* invariants hold */
+        }
+        timsort_mergeat(L, ts, k);
+    }
+}
+
+static void timsort (lua_State *L, TimSort *ts, int n) {
+    int lo = 1;
+    int hi = n + 1;
+    int minrun = timsort_minrun(n);
+    while (lo < hi) {
+        int remaining = hi - lo;
+        int runlen = timsort_countrun(L, lo, hi);
+        if (runlen < minrun) { /* extend short runs */
+            int force = (remaining <= minrun) ? remaining : minrun;
+            timsort_insertion(L, lo, lo + force, lo + runlen);
+            runlen = force;
+        }
+        lua_assert(ts->n < TIMSORT_MAXRUNS);
+        ts->base[ts->n] = lo;
+        ts->len[ts->n] = runlen;
+        ts->n++;
+        timsort_collapse(L, ts);
+        lo += runlen;
+    }
+    while (ts->n > 1) { /* merge everything that is left */
+        int k = ts->n - 2;
+        if (k > 0 && ts->len[k - 1] < ts->len[k + 1]) {
+            k--;
+        }
+        timsort_mergeat(L, ts, k);
+    }
+}
+
+static int timsort_aux (lua_State *L) {
+    TimSort *ts = (TimSort *) lua_touserdata(L, 5);
+    int n = (int) lua_tointeger(L, 4);
+    lua_settop(L, 3);
+    timsort(L, ts, n);
+    return 0;
+}
+
+static int table_sortstable (lua_State *L) {
+    int n = aux_getn(L, 1);
+    luaL_checkstack(L, 8, "");
+    if (!lua_isnoneornil(L, 2)) { /* is there a 2nd argument? */
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+    }
+    lua_settop(L, 2); /* make sure there is two arguments */
+    if (n > 1) {
+        TimSort ts;
+        ts.n = 0;
+        ts.buflo = 1;
+        ts.bufhi = 0;
+        ts.hole = 1;
+        lua_createtable(L, n / 2 + 1, 0); /* merge buffer */
+        lua_pushcfunction(L, timsort_aux);
+        lua_pushvalue(L, 1);
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, 3);
+        lua_pushinteger(L, n);
+        lua_pushlightuserdata(L, &ts);
+        if (lua_pcall(L, 5, 0, 0) != 0) {
+            for (; ts.buflo <= ts.bufhi; ts.buflo++) { /* refill the holes left by the merge */
+                timsort_move(L, 3, ts.buflo, 1, ts.hole++);
+            }
+            lua_error(L);
+        }
+    }
+    return 0;
+}
+
+/* }====================================================== */
+
 static int table_wipe (lua_State *L) {
     lua_settop(L, 1);
     luaL_checktype(L, 1, LUA_TTABLE);
+    lua_wipe(L, 1);
+    return 1;
+}
 
-    lua_pushnil(L); /* initial key for iteration */
+static int table_move (lua_State *L) {
+    int f = luaL_checkint(L, 2);
+    int e = luaL_checkint(L, 3);
+    int t = luaL_checkint(L, 4);
+    int tt = !lua_isnoneornil(L, 5) ? 5 : 1; /* destination table */
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_checktype(L, tt, LUA_TTABLE);
+    if (e >= f) { /* otherwise, nothing to move */
+        luaL_argcheck(L, f > 0 || e < INT_MAX + f, 3, "too many elements to move");
+        luaL_argcheck(L, t <= INT_MAX - (e - f), 4, "destination wrap around");
+        lua_rawmove(L, 1, f, e, t, tt);
+    }
+    lua_pushvalue(L, tt); /* return destination table */
+    return 1;
+}
 
-    while (lua_next(L, 1) != 0) {
-        lua_pop(L, 1);
-        lua_pushvalue(L, -1);
-        lua_pushnil(L);
-        lua_settable(L, 1);
+static int table_new (lua_State *L) {
+    int narray = luaL_optint(L, 1, 0);
+    int nrec = luaL_optint(L, 2, 0);
+    luaL_argcheck(L, narray >= 0, 1, "size must be non-negative");
+    luaL_argcheck(L, nrec >= 0, 2, "size must be non-negative");
+    lua_createtable(L, narray, nrec);
+    return 1;
+}
+
+static int table_reserve (lua_State *L) {
+    int narray = luaL_optint(L, 2, 0);
+    int nrec = luaL_optint(L, 3, 0);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_argcheck(L, narray >= 0, 2, "size must be non-negative");
+    luaL_argcheck(L, nrec >= 0, 3, "size must be non-negative");
+    lua_settop(L, 1);
+    lua_reservetable(L, 1, narray, nrec);
+    return 1;
+}
+
+static int table_compact (lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    lua_compacttable(L, 1);
+    return 1;
+}
+
+/*
+** Replace every table value in the copy at index 5 by its own copy, reusing
+** copies already made for the same original so that cycles and shared
+** references are preserved. New copies are queued to be scanned in turn.
+*/
+static void clone_scan (lua_State *L, int *pending) {
+    lua_pushnil(L);
+    while (lua_next(L, 5)) { /* key at 6, value at 7 */
+        if (lua_istable(L, 7)) {
+            lua_pushvalue(L, 7);
+            lua_rawget(L, 3);
+            if (lua_isnil(L, -1)) { /* not copied yet? */
+                lua_pop(L, 1);
+                lua_clonetable(L, 7);
+                lua_pushvalue(L, 7);
+                lua_pushvalue(L, -2);
+                lua_rawset(L, 3);
+                lua_pushvalue(L, -1);
+                lua_rawseti(L, 4, ++(*pending));
+            }
+            lua_pushvalue(L, 6);
+            lua_insert(L, -2);
+            lua_rawset(L, 5); /* existing field; does not disturb `next' */
+        }
+        lua_settop(L, 6);
     }
+}
 
+static int table_clone (lua_State *L) {
+    int deep = lua_toboolean(L, 2);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    lua_clonetable(L, 1);
+    if (deep) {
+        int pending = 1;
+        luaL_checkstack(L, 6, NULL);
+        lua_newtable(L); /* 3: originals to their copies */
+        lua_createtable(L, 1, 0); /* 4: copies yet to be scanned */
+        lua_pushvalue(L, 1);
+        lua_pushvalue(L, 2);
+        lua_rawset(L, 3);
+        lua_pushvalue(L, 2);
+        lua_rawseti(L, 4, 1);
+        while (pending > 0) {
+            lua_rawgeti(L, 4, pending); /* 5: copy to scan */
+            lua_pushnil(L);
+            lua_rawseti(L, 4, pending--);
+            clone_scan(L, &pending);
+            lua_settop(L, 4);
+        }
+        lua_settop(L, 2);
+    }
     return 1;
 }
 
@@ -293,22 +760,19 @@ static int table_removemulti (lua_State *L) {
     }
 
     lua_settop(L, 1); /* Keep the table as the only thing on the stack. */
+    luaL_checkstack(L, count + 1, "too many results to return");
 
-    for (int dsti = index; dsti <= length; ++dsti) {
-        const int srci = dsti + count;
+    for (int i = index; i < index + count; ++i) {
+        /* We're removing this, so push onto the stack to return it. */
+        lua_rawgeti(L, 1, i);
+    }
 
-        if (dsti <= (index + count - 1)) {
-            /* We're removing this, so push onto the stack to return it. */
-            lua_rawgeti(L, 1, dsti);
-        }
+    /* Shift the tail down over the removed range, then clear its old end. */
+    lua_rawmove(L, 1, index + count, length, index, 1);
 
-        if (srci <= length) {
-            lua_rawgeti(L, 1, srci);
-        } else {
-            lua_pushnil(L);
-        }
-
-        lua_rawseti(L, 1, dsti);
+    for (int i = length - count + 1; i <= length; ++i) {
+        lua_pushnil(L);
+        lua_rawseti(L, 1, i);
     }
 
     return count;
@@ -335,8 +799,21 @@ static const luaL_Reg tablib_shared[] = {
     /* clang-format on */
 };
 
+static const luaL_Reg tablib_lua[] = {
+    { "clone", table_clone },
+    { "compact", table_compact },
+    { "move", table_move },
+    { "new", table_new },
+    { "reserve", table_reserve },
+    { "sortstable", table_sortstable },
+    /* clang-format off */
+    { NULL, NULL },
+    /* clang-format on */
+};
+
 LUALIB_API int luaopen_table (lua_State *L) {
-    luaL_register(L, LUA_TABLIBNAME, tablib_shared);
+    luaL_register(L, LUA_TABLIBNAME, tablib_lua);
+    luaL_setfuncs(L, tablib_shared, 0);
     return 1;
 }
 
@@ -119,6 +119,7 @@ static void LoadConstants (LoadState *S, Proto *f) {
                 break;
         }
     }
+    luaF_newkhint(S->L, f);
     n = LoadInt(S);
     f->p = luaM_newvector(S->L, n, Proto *);
     f->sizep = n;
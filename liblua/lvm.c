@@ -43,10 +43,7 @@ int luaV_tostring (lua_State *L, StkId obj) {
     if (!ttisnumber(obj)) {
         return 0;
     } else {
-        char s[LUAI_MAXNUMBER2STR];
-        lua_Number n = nvalue(obj);
-        lua_number2str(s, n);
-        setsvalue2s(L, obj, luaS_new(L, s));
+        setsvalue2s(L, obj, luaS_fromnumber(L, nvalue(obj)));
         return 1;
     }
 }
@@ -75,8 +72,8 @@ static void callTMres (lua_State *L, StkId res, const TValue *f, const TValue *p
     setobj2s(L, L->top, f); /* push function */
     setobj2s(L, L->top + 1, p1); /* 1st argument */
     setobj2s(L, L->top + 2, p2); /* 2nd argument */
-    luaD_checkstack(L, 3);
     L->top += 3;
+    luaD_checkstack(L, 0);
     luaD_call(L, L->top - 3, 1);
     res = restorestack(L, result);
     L->top--;
@@ -88,18 +85,24 @@ static void callTM (lua_State *L, const TValue *f, const TValue *p1, const TValu
     setobj2s(L, L->top + 1, p1); /* 1st argument */
     setobj2s(L, L->top + 2, p2); /* 2nd argument */
     setobj2s(L, L->top + 3, p3); /* 3th argument */
-    luaD_checkstack(L, 4);
     L->top += 4;
+    luaD_checkstack(L, 0);
     luaD_call(L, L->top - 4, 0);
 }
 
-void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
+/*
+** `hint', if not NULL, is the node hint of a constant string `key'; it is
+** only used for the table indexed directly, not for those reached through
+** `__index'
+*/
+static void gettable (lua_State *L, const TValue *t, TValue *key, StkId val, int *hint) {
     int loop;
-    for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    for (loop = 0; loop < MAXTAGLOOP; loop++, hint = NULL) {
         const TValue *tm;
         if (ttistable(t)) { /* `t' is a table? */
             Table *h = hvalue(t);
-            const TValue *res = luaH_get(h, key); /* do a primitive get */
+            const TValue *res = (hint != NULL) ? luaH_getstrhint(h, rawtsvalue(key), hint)
+                                               : luaH_get(h, key); /* do a primitive get */
             if (!ttisnil(res) || /* result is no nil? */
                 (tm = fasttm(L, h->metatable, TM_INDEX)) == NULL) { /* or no TM? */
                 setobjt2s(L, t, key, val, res);
@@ -118,14 +121,22 @@ void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
     luaG_runerror(L, "loop in gettable");
 }
 
-void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
+void luaV_gettable (lua_State *L, const TValue *t, TValue *key, StkId val) {
+    gettable(L, t, key, val, NULL);
+}
+
+/*
+** `hint' is used as in `gettable'
+*/
+static void settable (lua_State *L, const TValue *t, TValue *key, StkId val, int *hint) {
     int loop;
     TValue temp;
-    for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    for (loop = 0; loop < MAXTAGLOOP; loop++, hint = NULL) {
         const TValue *tm;
         if (ttistable(t)) { /* `t' is a table? */
             Table *h = hvalue(t);
-            TValue *oldval = luaH_set(L, h, key); /* do a primitive set */
+            TValue *oldval = (hint != NULL) ? luaH_setstrhint(L, h, key, hint)
+                                            : luaH_set(L, h, key); /* do a primitive set */
             if (!ttisnil(oldval) || /* result is no nil? */
                 (tm = fasttm(L, h->metatable, TM_NEWINDEX)) == NULL) { /* or no TM? */
                 setobj2t(L, t, key, oldval, val);
@@ -149,6 +160,10 @@ void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
     luaG_runerror(L, "loop in settable");
 }
 
+void luaV_settable (lua_State *L, const TValue *t, TValue *key, StkId val) {
+    settable(L, t, key, val, NULL);
+}
+
 static int call_binTM (lua_State *L, const TValue *p1, const TValue *p2, StkId res, TMS event) {
     const TValue *tm = luaT_gettmbyobj(L, p1, event); /* try first operand */
     if (ttisnil(tm)) {
@@ -194,7 +209,7 @@ static int call_orderTM (lua_State *L, const TValue *p1, const TValue *p2, TMS e
     return !l_isfalse(L->top);
 }
 
-static int l_strcmp (const TString *ls, const TString *rs) {
+int luaV_strcmp (const TString *ls, const TString *rs) {
     const char *l = getstr(ls);
     size_t ll = ls->tsv.len;
     const char *r = getstr(rs);
@@ -227,7 +242,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
     } else if (ttisnumber(l)) {
         return luai_numlt(nvalue(l), nvalue(r));
     } else if (ttisstring(l)) {
-        return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
+        return luaV_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
     } else if ((res = call_orderTM(L, l, r, TM_LT)) != -1) {
         return res;
     }
@@ -241,7 +256,7 @@ static int lessequal (lua_State *L, const TValue *l, const TValue *r) {
     } else if (ttisnumber(l)) {
         return luai_numle(nvalue(l), nvalue(r));
     } else if (ttisstring(l)) {
-        return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
+        return luaV_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
     } else if ((res = call_orderTM(L, l, r, TM_LE)) != -1) { /* first try `le' */
         return res;
     } else if ((res = call_orderTM(L, r, l, TM_LT)) != -1) { /* else try `lt' */
@@ -299,8 +314,6 @@ void luaV_concat (lua_State *L, int total, int last) {
         } else {
             /* at least two string values; get as many as possible */
             size_t tl = tsvalue(top - 1)->len;
-            char *buffer;
-            int i;
             /* collect total length */
             for (n = 1; n < total && tostring(L, top - n - 1); n++) {
                 size_t l = tsvalue(top - n - 1)->len;
@@ -309,20 +322,60 @@ void luaV_concat (lua_State *L, int total, int last) {
                 }
                 tl += l;
             }
-            buffer = luaZ_openspace(L, &G(L)->buff, tl);
-            tl = 0;
-            for (i = n; i > 0; i--) { /* concat all strings */
-                size_t l = tsvalue(top - i)->len;
-                memcpy(buffer + tl, svalue(top - i), l);
-                tl += l;
+            if (tl >= LUAI_MINDIRECTCONCAT) {
+                setsvalue2s(L, top - n, luaS_newconcat(L, top - n, n, tl));
+            } else {
+                char *buffer = luaZ_openspace(L, &G(L)->buff, tl);
+                int i;
+                tl = 0;
+                for (i = n; i > 0; i--) { /* concat all strings */
+                    size_t l = tsvalue(top - i)->len;
+                    memcpy(buffer + tl, svalue(top - i), l);
+                    tl += l;
+                }
+                setsvalue2s(L, top - n, luaS_newlstr(L, buffer, tl));
             }
-            setsvalue2s(L, top - n, luaS_newlstr(L, buffer, tl));
         }
         total -= n - 1; /* got `n' strings to create 1 new */
         last -= n - 1;
     } while (total > 1); /* repeat until only 1 result left */
 }
 
+/*
+** Join the `n' values at the top of the stack, which must be strings or
+** numbers, with `sep' between each pair. The result replaces the first
+** value; the others are left for the caller to pop.
+*/
+void luaV_join (lua_State *L, int n, const char *sep, size_t lsep) {
+    StkId first = L->top - n;
+    StkId o;
+    TString *ts;
+    char *buff;
+    size_t tl = 0;
+    for (o = first; o < L->top; o++) { /* collect total length */
+        size_t l;
+        if (!tostring(L, o)) {
+            luaG_concaterror(L, o, o);
+        }
+        l = tsvalue(o)->len + (o > first ? lsep : 0);
+        if (l >= LUA_SIZE_MAX - tl) {
+            luaG_runerror(L, "string length overflow");
+        }
+        tl += l;
+    }
+    ts = luaS_prepare(L, tl);
+    buff = cast(char *, ts + 1);
+    for (o = first; o < L->top; o++) {
+        if (o > first) {
+            memcpy(buff, sep, lsep);
+            buff += lsep;
+        }
+        memcpy(buff, svalue(o), tsvalue(o)->len);
+        buff += tsvalue(o)->len;
+    }
+    setsvalue2s(L, first, luaS_intern(L, ts));
+}
+
 static void checkfp (lua_State *L, int mask, lua_Number nb, lua_Number nc) {
     if (L->exceptmask & mask) {
         int fb = fpclassify(nb);
@@ -400,6 +453,7 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb, const TValue *rc, T
 #define RKC(i)                                                                                                         \
     check_exp(getCMode(GET_OPCODE(i)) == OpArgK, ISK(GETARG_C(i)) ? k + INDEXK(GETARG_C(i)) : base + GETARG_C(i))
 #define KBx(i) check_exp(getBMode(GET_OPCODE(i)) == OpArgK, k + GETARG_Bx(i))
+#define KHINT(rk) (ISK(rk) && ttisstring(k + INDEXK(rk)) ? &cl->p->khint[INDEXK(rk)] : NULL)
 
 #define dojump(L, pc, i)                                                                                               \
     {                                                                                                                  \
@@ -425,6 +479,45 @@ static void Arith (lua_State *L, StkId ra, const TValue *rb, const TValue *rc, T
             Protect(Arith(L, ra, rb, rc, tm));                                                                         \
     }
 
+/*
+** true if the generic `for' call at `cb' would call the library `next'
+** with a table, and nothing else can observe that call
+*/
+#define isinlinenext(L, cb)                                                                                            \
+    (iscfunction(cb) && clvalue(cb)->c.f == G(L)->nextf && ttistable((cb) + 1) &&                                      \
+     !((L)->hookmask & (LUA_MASKCALL | LUA_MASKRET)) && !(G(L)->enablestats && clvalue(cb)->c.stats != NULL))
+
+/*
+** Step the generic `for' at `cb' as a call to `next' would, leaving the
+** same `nresults' results at `cb' with the same taint. The key is moved
+** into the slot of the table so that its successor and value land within
+** the frame. Returns 0 if the key is not in the table, so that the call can
+** raise the error.
+*/
+static int inlinenext (lua_State *L, StkId cb, int nresults) {
+    StkId res = cb;
+    TValue state = *(cb + 1);
+    int more;
+    setobj(L, cb + 1, cb + 2);
+    more = luaH_trynext(L, hvalue(&state), cb + 1);
+    if (more < 0) {
+        setobj(L, cb + 2, cb + 1); /* restore the call arguments */
+        setobj(L, cb + 1, &state);
+        return 0;
+    } else if (more) {
+        setobjs2s(L, res++, cb + 1);
+        if (nresults > 1) {
+            setobjs2s(L, res++, cb + 2);
+        }
+    } else {
+        setnilvalue(L, res++);
+    }
+    while (res < cb + nresults) {
+        setnilvalue(L, res++);
+    }
+    return 1;
+}
+
 void luaV_execute (lua_State *L, int nexeccalls) {
     LClosure *cl;
     StkId base;
@@ -513,18 +606,18 @@ reentry: /* entry point */
                 TValue *rb = KBx(i);
                 sethvalue(L, &g, cl->env);
                 lua_assert(ttisstring(rb));
-                Protect(luaV_gettable(L, &g, rb, ra));
+                Protect(gettable(L, &g, rb, ra, &cl->p->khint[GETARG_Bx(i)]));
                 continue;
             }
             case OP_GETTABLE: {
-                Protect(luaV_gettable(L, RB(i), RKC(i), ra));
+                Protect(gettable(L, RB(i), RKC(i), ra, KHINT(GETARG_C(i))));
                 continue;
             }
             case OP_SETGLOBAL: {
                 TValue g;
                 sethvalue(L, &g, cl->env);
                 lua_assert(ttisstring(KBx(i)));
-                Protect(luaV_settable(L, &g, KBx(i), ra));
+                Protect(settable(L, &g, KBx(i), ra, &cl->p->khint[GETARG_Bx(i)]));
                 continue;
             }
             case OP_SETUPVAL: {
@@ -534,20 +627,24 @@ reentry: /* entry point */
                 continue;
             }
             case OP_SETTABLE: {
-                Protect(luaV_settable(L, ra, RKB(i), RKC(i)));
+                Protect(settable(L, ra, RKB(i), RKC(i), KHINT(GETARG_B(i))));
                 continue;
             }
             case OP_NEWTABLE: {
                 int b = GETARG_B(i);
                 int c = GETARG_C(i);
-                sethvalue(L, ra, luaH_new(L, luaO_fb2int(b), luaO_fb2int(c)));
+                Table *t = luaH_new(L);
+                sethvalue(L, ra, t);
+                if (b != 0 || c != 0) {
+                    luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
+                }
                 Protect(luaC_checkGC(L));
                 continue;
             }
             case OP_SELF: {
                 StkId rb = RB(i);
                 setobjs2s(L, ra + 1, rb);
-                Protect(luaV_gettable(L, rb, RKC(i), ra));
+                Protect(gettable(L, rb, RKC(i), ra, KHINT(GETARG_C(i))));
                 continue;
             }
             case OP_ADD: {
@@ -770,8 +867,10 @@ reentry: /* entry point */
                 setobjs2s(L, cb + 2, ra + 2);
                 setobjs2s(L, cb + 1, ra + 1);
                 setobjs2s(L, cb, ra);
-                L->top = cb + 3; /* func. + 2 args (state and index) */
-                Protect(luaD_call(L, cb, GETARG_C(i)));
+                if (!isinlinenext(L, cb) || !inlinenext(L, cb, GETARG_C(i))) {
+                    L->top = cb + 3; /* func. + 2 args (state and index) */
+                    Protect(luaD_call(L, cb, GETARG_C(i)));
+                }
                 L->top = L->ci->top;
                 cb = RA(i) + 3; /* previous call may change the stack */
                 if (!ttisnil(cb)) { /* continue loop? */
@@ -788,7 +887,6 @@ reentry: /* entry point */
                 Table *h;
                 if (n == 0) {
                     n = cast_int(L->top - ra) - 1;
-                    L->top = L->ci->top;
                 }
                 if (c == 0) {
                     c = cast_int(*pc++);
@@ -806,6 +904,7 @@ reentry: /* entry point */
                     setobj2t(L, ra, &key, luaH_setnum(L, h, last--), val);
                     luaC_barriert(L, h, val);
                 }
+                L->top = L->ci->top; /* correct top only once values are stored */
                 continue;
             }
             case OP_CLOSE: {
@@ -818,6 +917,7 @@ reentry: /* entry point */
                 int j;
                 p = cl->p->p[GETARG_Bx(i)];
                 ncl = luaF_newLclosure(L, p, cl->env);
+                setclvalue(L, ra, ncl); /* anchor new closure */
                 for (j = 0; j < p->nups; j++, pc++) {
                     if (GET_OPCODE(*pc) == OP_GETUPVAL) {
                         ncl->l.upvals[j] = cl->upvals[GETARG_B(*pc)];
@@ -826,7 +926,6 @@ reentry: /* entry point */
                         ncl->l.upvals[j] = luaF_findupval(L, base + GETARG_B(*pc));
                     }
                 }
-                setclvalue(L, ra, ncl);
                 Protect(luaC_checkGC(L));
                 continue;
             }
@@ -85,6 +85,178 @@ static void test_protecttaint_tainted_error (void) {
     lua_close(L);
 }
 
+static void test_memorylimit_exceeded (void) {
+    int status;
+
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+    lua_setmemorylimit(L, (size_t) lua_gc(L, LUA_GCCOUNT, 0) * 1024 + 65536);
+    luaL_loadstring(L, "local t = {} while true do t[#t + 1] = {} end");
+    status = lua_pcall(L, 0, 0, 0);
+    TEST_CHECK((status == LUA_ERRMEM));
+    lua_close(L);
+}
+
+static void test_memorylimit_collects (void) {
+    int status;
+
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+    lua_gc(L, LUA_GCSETPAUSE, 1000); /* rely on emergency collections */
+    lua_setmemorylimit(L, (size_t) lua_gc(L, LUA_GCCOUNT, 0) * 1024 + 65536);
+    luaL_loadstring(L, "for i = 1, 100000 do local t = { i, tostring(i) } end");
+    status = lua_pcall(L, 0, 0, 0);
+    TEST_CHECK((status == 0));
+    TEST_CHECK((lua_gc(L, LUA_GCCOUNT, 0) * 1024 <= (int) lua_getmemorylimit(L)));
+    lua_close(L);
+}
+
+static void test_memorylimit_huge (void) {
+    int status;
+
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+    luaL_loadstring(L, "debug.setmemorylimit(math.huge)");
+    status = lua_pcall(L, 0, 0, 0);
+    TEST_CHECK((status == 0 && lua_getmemorylimit(L) == (size_t) -1));
+    luaL_loadstring(L, "debug.setmemorylimit(2 ^ 70) return #string.rep('x', 16384)");
+    status = lua_pcall(L, 0, 1, 0);
+    TEST_CHECK((status == 0 && lua_getmemorylimit(L) == (size_t) -1 && lua_tointeger(L, -1) == 16384));
+    lua_pop(L, 1);
+    luaL_loadstring(L, "debug.setmemorylimit(-1)");
+    status = lua_pcall(L, 0, 0, 0);
+    TEST_CHECK((status == LUA_ERRRUN));
+    lua_close(L);
+}
+
+static void test_memorylimit_buffer (void) {
+    int status;
+    int before;
+    luaL_Buffer b;
+
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+    lua_gc(L, LUA_GCSTOP, 0);
+    before = lua_gc(L, LUA_GCCOUNT, 0);
+    luaL_buffinit(L, &b);
+    luaL_prepbuffsize(&b, 262144);
+    TEST_CHECK((lua_gc(L, LUA_GCCOUNT, 0) - before >= 256));
+    luaL_pushresult(&b);
+    lua_pop(L, 1);
+    lua_gc(L, LUA_GCRESTART, 0);
+
+    lua_setmemorylimit(L, (size_t) lua_gc(L, LUA_GCCOUNT, 0) * 1024 + 65536);
+    luaL_loadstring(L, "return string.rep('x', 1048576)");
+    status = lua_pcall(L, 0, 1, 0);
+    TEST_CHECK((status == LUA_ERRMEM));
+    lua_pop(L, 1);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    luaL_loadstring(L, "return #string.rep('x', 16384)");
+    status = lua_pcall(L, 0, 1, 0);
+    TEST_CHECK((status == 0 && lua_tointeger(L, -1) == 16384));
+    lua_close(L);
+}
+
+static void test_finalizerbatch_bounded (void) {
+    lua_GlobalStats stats;
+    size_t pending;
+    size_t peak = 0;
+    int steps;
+
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+    lua_gc(L, LUA_GCSETFINBATCH, 4);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gc(L, LUA_GCSTOP, 0);
+    luaL_loadstring(L, "for i = 1, 100 do getmetatable(newproxy(true)).__gc = function() end end");
+    TEST_CHECK((lua_pcall(L, 0, 0, 0) == 0));
+    lua_gc(L, LUA_GCRESTART, 0);
+
+    for (steps = 0; steps < 10000; steps++) {
+        lua_getglobalstats(L, &stats);
+        pending = stats.pendingfinalizers;
+        lua_gc(L, LUA_GCSTEP, 0);
+        lua_getglobalstats(L, &stats);
+        TEST_CHECK((pending <= stats.pendingfinalizers + 4));
+        peak = (stats.pendingfinalizers > peak) ? stats.pendingfinalizers : peak;
+        if (peak != 0 && stats.pendingfinalizers == 0) {
+            break;
+        }
+    }
+
+    TEST_CHECK((peak == 100));
+    TEST_CHECK((stats.pendingfinalizers == 0));
+    lua_close(L);
+}
+
+static void test_ephemeron_collects_cycles (void) {
+    static const char script[] = "local t = setmetatable({}, { __mode = 'k' })\n"
+                                 "local live = {}\n"
+                                 "for i = 1, 100 do local k = {}; t[k] = { k }; if i <= 10 then live[i] = k end end\n"
+                                 "collectgarbage('collect')\n"
+                                 "local n = 0; for k, v in pairs(t) do assert(v[1] == k); n = n + 1 end\n"
+                                 "assert(n == #live, n)\n";
+
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+    lua_setcompatopt(L, LUA_COMPATEPHEMERON, 1);
+    luaL_loadstring(L, script);
+    TEST_CHECK((lua_pcall(L, 0, 0, 0) == 0));
+    lua_close(L);
+}
+
+static void test_wipe_secure (void) {
+    lua_State *L = luatest_newstate();
+    lua_createtable(L, 1, 1);
+    lua_pushboolean(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_pushboolean(L, 1);
+    lua_setfield(L, -2, "key");
+    lua_wipe(L, -1);
+    lua_pushnil(L);
+    TEST_CHECK((lua_next(L, -2) == 0));
+    lua_getfield(L, -1, "key");
+    TEST_CHECK((lua_isnil(L, -1) && luaL_issecurevalue(L, -1)));
+    lua_close(L);
+}
+
+static void test_wipe_tainted (void) {
+    lua_State *L = luatest_newstate();
+    lua_createtable(L, 1, 1);
+    lua_pushboolean(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_pushboolean(L, 1);
+    lua_setfield(L, -2, "key");
+    lua_setstacktaint(L, LUA_FORCEINSECURE_TAINT);
+    lua_wipe(L, -1);
+    lua_setstacktaint(L, NULL);
+    lua_rawgeti(L, -1, 1);
+    TEST_CHECK((lua_isnil(L, -1) && !luaL_issecurevalue(L, -1)));
+    lua_getfield(L, -2, "key");
+    TEST_CHECK((lua_isnil(L, -1) && !luaL_issecurevalue(L, -1)));
+    lua_close(L);
+}
+
+static void test_clone_tainted (void) {
+    lua_State *L = luatest_newstate();
+    lua_createtable(L, 1, 1);
+    lua_pushboolean(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_pushboolean(L, 1);
+    lua_setfield(L, -2, "key");
+    lua_setstacktaint(L, LUA_FORCEINSECURE_TAINT);
+    lua_clonetable(L, -1);
+    lua_setstacktaint(L, NULL);
+    lua_rawgeti(L, -1, 1);
+    TEST_CHECK((lua_toboolean(L, -1) && !luaL_issecurevalue(L, -1)));
+    lua_getfield(L, -2, "key");
+    TEST_CHECK((lua_toboolean(L, -1) && !luaL_issecurevalue(L, -1)));
+    lua_setstacktaint(L, NULL);
+    lua_rawgeti(L, -4, 1);
+    TEST_CHECK((luaL_issecurevalue(L, -1)));
+    lua_close(L);
+}
+
 /*
 ** Scripted Test Cases
 */
@@ -149,6 +321,36 @@ static void test_profilingscriptcases (void) {
     lua_close(L);
 }
 
+static void test_tablescriptcases (void) {
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+
+    /* Add custom test case registration function to environment. */
+    lua_pushcclosure(L, &luatest_case, 0);
+    lua_setfield(L, LUA_GLOBALSINDEX, "case");
+
+    if (!TEST_CHECK((luaL_dofile(L, "luatest_table.lua") == 0))) {
+        TEST_MSG("%s", (luaL_optstring(L, -1, "<unknown script error>")));
+    }
+
+    lua_close(L);
+}
+
+static void test_stringscriptcases (void) {
+    lua_State *L = luatest_newstate();
+    luaL_openlibs(L);
+
+    /* Add custom test case registration function to environment. */
+    lua_pushcclosure(L, &luatest_case, 0);
+    lua_setfield(L, LUA_GLOBALSINDEX, "case");
+
+    if (!TEST_CHECK((luaL_dofile(L, "luatest_string.lua") == 0))) {
+        TEST_MSG("%s", (luaL_optstring(L, -1, "<unknown script error>")));
+    }
+
+    lua_close(L);
+}
+
 /*
 ** Test Case Registration
 */
@@ -158,9 +360,20 @@ TEST_LIST = {
     { "lua_protecttaint: stack remains tainted after call", test_protecttaint_tainted_normal },
     { "lua_protecttaint: stack restored to secure on error", test_protecttaint_secure_error },
     { "lua_protecttaint: stack restored to tainted on error", test_protecttaint_tainted_error },
+    { "lua_setmemorylimit: allocations beyond the limit fail", test_memorylimit_exceeded },
+    { "lua_setmemorylimit: garbage is collected to stay within the limit", test_memorylimit_collects },
+    { "lua_setmemorylimit: huge limits from the debug library are clamped", test_memorylimit_huge },
+    { "lua_setmemorylimit: string buffers stay within the limit", test_memorylimit_buffer },
+    { "lua_gc: finalizers run in bounded batches", test_finalizerbatch_bounded },
+    { "lua_setcompatopt: ephemeron tables collect self-referencing entries", test_ephemeron_collects_cycles },
+    { "lua_wipe: secure wipe leaves no entries behind", test_wipe_secure },
+    { "lua_wipe: insecure wipe taints cleared entries", test_wipe_tainted },
+    { "lua_clonetable: insecure clone taints copied values", test_clone_tainted },
     { "scripted test cases", test_scriptcases },
     { "coroutine script tests", test_coroutinescriptcases },
     { "profiling script tests", test_profilingscriptcases },
+    { "table script tests", test_tablescriptcases },
+    { "string script tests", test_stringscriptcases },
     /* clang-format off */
     { NULL, NULL },
     /* clang-format on */
@@ -0,0 +1,320 @@
+--
+-- String library tests
+--
+
+-- luacheck: globals strjoin strsplit strsplittable
+
+case("patterns: repeated patterns match as on first use", function()
+    for _ = 1, 3 do
+        assert(string.match("key = value", "^(%w+)%s*=%s*(%w+)$") == "key")
+        assert(select(2, string.match("key = value", "^(%w+)%s*=%s*(%w+)$")) == "value")
+        assert(string.find("a.b.c", "%.", 3) == 4)
+        assert(string.find("[x]", "[]]") == 3)
+        assert(string.match("f(a(b)c)d", "%b()") == "(a(b)c)")
+        assert(string.match("THE (quick) fox", "%f[%a]%a+", 5) == "quick")
+        assert(string.gsub("hello world", "o", "0") == "hell0 w0rld")
+        assert(string.gsub("abc", "%w", "%0%0") == "aabbcc")
+        assert(string.gsub("abc", "", "-") == "-a-b-c-")
+        assert(string.find("abc", "^b") == nil)
+    end
+end)
+
+case("patterns: malformed patterns raise errors only when reached", function()
+    assert(string.find("", "a%") == nil)
+    assert(not pcall(string.find, "a", "a%"))
+    assert(not pcall(string.find, "a", "[a"))
+    assert(not pcall(string.match, "a", "%b"))
+    assert(not pcall(string.gsub, "a", "%f", ""))
+    assert(not pcall(string.find, "a", "(a)%2"))
+    assert(not pcall(string.match, "a", "a)"))
+end)
+
+case("patterns: gmatch treats a leading '^' literally", function()
+    local out = {}
+    for w in string.gmatch("^a ^b c", "^%a") do
+        out[#out + 1] = w
+    end
+    assert(#out == 2 and out[1] == "^a" and out[2] == "^b")
+end)
+
+case("patterns: evicting a pattern during gsub is safe", function()
+    local s = string.gsub("a1b2c3d4", "%d", function(d)
+        for i = 1, 100 do
+            string.find("x", "x" .. i .. "%d*")
+        end
+        collectgarbage()
+        return "<" .. d .. ">"
+    end)
+    assert(s == "a<1>b<2>c<3>d<4>")
+end)
+
+case("string.find: plain searches in repetitive text", function()
+    local function naive(s, p, init)
+        for i = init, #s - #p + 1 do
+            if string.sub(s, i, i + #p - 1) == p then
+                return i, i + #p - 1
+            end
+        end
+    end
+    local s = string.rep("ab", 200) .. "abb" .. string.rep("aab", 100) .. "abaabab"
+    for _, p in ipairs({ "abb", "aab", "abab", "abaabab", "aabaabaab", "bba", "abababababababababababab" }) do
+        for init = 1, 40, 13 do
+            local i, j = string.find(s, p, init, true)
+            local ni, nj = naive(s, p, init)
+            assert(i == ni and j == nj)
+        end
+    end
+    assert(string.find(string.rep("a", 1000), string.rep("a", 100) .. "b", 1, true) == nil)
+end)
+
+case("patterns: literal prefixes skip to their first occurrence", function()
+    local s = string.rep("key=1;", 100) .. "name=Arthas;"
+    assert(string.match(s, "name=(%a+)") == "Arthas")
+    assert(select(2, string.gsub(s, "key=%d", "")) == 100)
+end)
+
+case("concatenation: long results are built in place", function()
+    local parts = {}
+    local s = ""
+    for i = 1, 500 do
+        local piece = "piece " .. i .. ";"
+        parts[i] = piece
+        s = s .. piece
+    end
+    assert(s == table.concat(parts))
+    local a = string.rep("x", 600)
+    local t = {}
+    for i = 1, 10 do
+        t[a .. "-" .. a] = i
+    end
+    assert(next(t) == a .. "-" .. a and t[string.rep("x", 600) .. "-" .. a] == 10)
+    assert(a .. 1 .. a .. 2.5 == a .. "1" .. a .. "2.5")
+end)
+
+case("buffers: large results are assembled once", function()
+    local s = string.rep("abc", 100000)
+    assert(#s == 300000 and string.sub(s, -6) == "abcabc")
+    local t = {}
+    for i = 1, 20000 do
+        t[i] = i % 2 == 0 and i or string.rep("y", i % 50)
+    end
+    local joined = table.concat(t, ",")
+    assert(select(2, string.gsub(joined, ",", ",")) == 19999)
+    local big = string.rep("z", 20000)
+    local r = string.gsub(string.rep("ab", 100), "a", function() return big end)
+    assert(#r == 100 * 20001 and string.find(r, "zb" .. big, 1, true) == 20000)
+    assert(string.upper(s) == string.rep("ABC", 100000))
+end)
+
+case("strjoin: truncates pieces at embedded zeros unless the compatibility option is set", function()
+    assert(strjoin(", ", "a", 1, "b") == "a, 1, b")
+    assert(strjoin("\0", "x\0y", "z") == "x\0z")
+    debug.setcompatopt("strsplit", 1)
+    local full = strjoin("\0", "x\0y", "z")
+    debug.setcompatopt("strsplit", 0)
+    assert(full == "x\0y\0z")
+    assert(strjoin(",") == "" and strjoin(",", "a") == "a")
+    assert(not pcall(strjoin, ",", "a", {}))
+end)
+
+case("strsplit: fields match a naive split", function()
+    local function naive(delim, str, limit)
+        local out = {}
+        local start = 1
+        for i = 1, #str do
+            if (limit == 0 or #out < limit - 1) and string.find(delim, string.sub(str, i, i), 1, true) then
+                out[#out + 1] = string.sub(str, start, i - 1)
+                start = i + 1
+            end
+        end
+        out[#out + 1] = string.sub(str, start)
+        return out
+    end
+    local alphabet = "abc,;: -|"
+    for _, delim in ipairs({ ",", ",;", ",;: ", ",;: -|", "x" }) do
+        for n = 0, 70, 7 do
+            local chars = {}
+            for i = 1, n do
+                local k = (i * 7 + n * 3 + #delim) % #alphabet + 1
+                chars[i] = string.sub(alphabet, k, k)
+            end
+            local str = table.concat(chars)
+            for _, limit in ipairs({ 0, 1, 2, 5 }) do
+                local expected = naive(delim, str, limit)
+                local fields = { strsplit(delim, str, limit) }
+                local tbl = strsplittable(delim, str, limit)
+                assert(#fields == #expected and #tbl == #expected)
+                for i = 1, #expected do
+                    assert(fields[i] == expected[i] and tbl[i] == expected[i])
+                end
+            end
+        end
+    end
+end)
+
+case("strsplittable: splits many fields", function()
+    local t = {}
+    for i = 1, 100000 do
+        t[i] = i
+    end
+    local fields = strsplittable(",", table.concat(t, ","))
+    assert(#fields == 100000 and fields[1] == "1" and fields[100000] == "100000")
+    assert(select("#", strsplit(",", table.concat(t, ",", 1, 5000))) == 5000)
+end)
+
+case("strsplit: the compatibility option splits past embedded zeros", function()
+    debug.setcompatopt("strsplit", 1)
+    local ok, a, b, c = pcall(strsplit, "\0", "a\0b\0c")
+    local tbl = strsplittable(" ", "a \0b c")
+    debug.setcompatopt("strsplit", 0)
+    assert(ok and a == "a" and b == "b" and c == "c")
+    assert(#tbl == 3 and tbl[2] == "\0b")
+    assert(select("#", strsplit(" ", "a \0b c")) == 2)
+end)
+
+case("string.format: fast conversions match the generic ones", function()
+    local values = { 0, 1, -1, 7, 42, -123456, 2147483647, -2147483648, 1e15, 12345678901 }
+    for _, v in ipairs(values) do
+        assert(string.format("%d", v) == string.format("%1d", v))
+        assert(string.format("%i|%d", v, v) == string.format("%1i|%1d", v, v))
+    end
+    for _, v in ipairs({ 0, 0.5, 1.005, -2.675, 3.14159265358979, 1 / 3, 123456.789, 1e-300, 2 ^ 52 + 0.5, 1e20 }) do
+        for prec = 0, 15 do
+            local fast = string.format("%." .. prec .. "f", v)
+            local generic = string.format("%1." .. prec .. "f", v)
+            assert(fast == generic, fast .. " ~= " .. generic)
+        end
+    end
+    assert(string.format("%s", "a\0b") == "a")
+    assert(string.format("%s|%s", 12, "x") == "12|x")
+    assert(string.format("%d|%d", "x") == "0|0")
+end)
+
+case("string.format: rounds halfway cases to even", function()
+    assert(string.format("%.0f", 0.5) == "0")
+    assert(string.format("%.0f", 1.5) == "2")
+    assert(string.format("%.0f", 2.5) == "2")
+    assert(string.format("%.2f", 0.125) == "0.12")
+    assert(string.format("%.2f", 0.375) == "0.38")
+    assert(string.format("%.1f", -0.25) == "-0.2")
+end)
+
+case("string.format: handles signed zero and non-finite values", function()
+    assert(string.format("%.1f", -0.0) == "-0.0")
+    assert(string.format("%.3f", 1 / 0) == string.format("%g", 1 / 0))
+    assert(string.format("%.3f", -1 / 0) == string.format("%g", -1 / 0))
+end)
+
+case("string.format: reuses parsed formats", function()
+    for i = 1, 100 do
+        local fmt = "%d:%s:%.2f%%" .. (i % 40)
+        assert(string.format(fmt, i, "v", i / 4) == i .. ":v:" .. string.format("%5.2f", i / 4):gsub("^ +", "") .. "%" .. (i % 40))
+    end
+end)
+
+case("string.format: reports errors in malformed formats", function()
+    assert(not pcall(string.format, "%d %", 1))
+    assert(not pcall(string.format, "%y", 1))
+    assert(not pcall(string.format, "%10.123f", 1))
+    assert(string.format("%%") == "%")
+end)
+
+case("tostring: numbers convert as \"%.14g\" does", function()
+    local values = {
+        0, 1, -1, 0.1, 0.5, 1 / 3, -2 / 3, 1e-4, 1e-5, 9.99999999999999e-5, 12.25, 123456.789,
+        99999999999999, 99999999999999.5, 1e14, 2 ^ 52 + 0.5, 2 ^ 53, 1e300, 5e-324, 0.30000000000000004,
+    }
+    for _, v in ipairs(values) do
+        for _, n in ipairs({ v, -v }) do
+            local expected = string.format("%.14g", n)
+            assert(tostring(n) == expected and n .. "" == expected, expected)
+        end
+    end
+    for i = 1, 1000 do
+        local n = i / 7 - 50
+        assert(tostring(n) == string.format("%.14g", n))
+    end
+    assert(tostring(1 / 0) == string.format("%.14g", 1 / 0))
+    assert(tostring(-1 / 0) == string.format("%.14g", -1 / 0))
+end)
+
+case("tostring: cached number strings survive collections", function()
+    local zero = 0
+    local negzero = -zero
+    for round = 1, 20 do
+        for i = 1, 300 do
+            assert(tostring(i) == string.format("%d", i))
+            assert(tostring(i + 0.5) == string.format("%.1f", i + 0.5))
+        end
+        assert(tostring(zero) == "0" and tostring(negzero) == string.format("%.14g", negzero))
+        collectgarbage(round % 2 == 0 and "collect" or "step")
+    end
+end)
+
+case("strlenutf8: counts characters as their lead bytes delimit them", function()
+    local long = string.rep("abcdéfgh中ij😀", 20)
+    assert(strlenutf8("") == 0)
+    assert(strlenutf8(string.rep("a", 100)) == 100)
+    assert(strlenutf8(long) == 20 * 12)
+    assert(strlenutf8(string.rep("x", 15) .. "中" .. string.rep("y", 30)) == 46)
+    assert(strlenutf8(string.rep("a", 20) .. "\128\191" .. string.rep("b", 20)) == 42)
+    assert(strlenutf8(string.rep("a", 20) .. "\226ab" .. string.rep("b", 20)) == 41)
+    assert(strlenutf8("ab\0cd") == 2)
+end)
+
+case("strcmputf8i: compares ignoring ASCII case", function()
+    local long = string.rep("Hello, World! ", 10)
+    assert(strcmputf8i("abc", "ABC") == 0)
+    assert(strcmputf8i("abc", "abd") == -1 and strcmputf8i("abd", "ABC") == 1)
+    assert(strcmputf8i("ab", "abc") == -1 and strcmputf8i("abc", "AB") == 1)
+    assert(strcmputf8i(long, long:upper()) == 0)
+    assert(strcmputf8i(long .. "a", long:lower() .. "B") == -1)
+    assert(strcmputf8i(long .. "中", long:upper() .. "中") == 0)
+    assert(strcmputf8i(long .. "é", long .. "f") == 1)
+    assert(strcmputf8i("[", "a") == strcmputf8i("[", "A"))
+end)
+
+case("string.utf8sub: selects characters by position", function()
+    local s = "aé中😀z"
+    assert(s:utf8sub(1) == s and s:utf8sub(2) == "é中😀z")
+    assert(s:utf8sub(2, 3) == "é中" and s:utf8sub(4, 4) == "😀")
+    assert(s:utf8sub(-2) == "😀z" and s:utf8sub(-4, -3) == "é中")
+    assert(s:utf8sub(0, 1) == "a" and s:utf8sub(3, 100) == "中😀z")
+    assert(s:utf8sub(4, 2) == "" and s:utf8sub(6) == "" and s:utf8sub(-100, 1) == "a")
+    local long = string.rep("x", 40) .. "中"
+    assert(long:utf8sub(41) == "中" and long:utf8sub(-1) == "中" and long:utf8sub(17, 18) == "xx")
+end)
+
+case("string.utf8iter: yields each character once", function()
+    local positions, chars = {}, {}
+    for pos, c in string.utf8iter("aé中\128😀") do
+        positions[#positions + 1] = pos
+        chars[#chars + 1] = c
+    end
+    assert(table.concat(positions, ",") == "1,2,4,7,8")
+    assert(table.concat(chars, "|") == "a|é|中|\128|😀")
+    for _ in string.utf8iter("") do
+        error("empty string has no characters")
+    end
+    local n = 0
+    for _, c in ("\240\159"):utf8iter() do
+        n = n + 1
+        assert(c == "\240\159")
+    end
+    assert(n == 1)
+end)
+
+case("strsplit: too many fields raise a stack overflow error", function()
+    local ok, err = pcall(strsplit, ",", string.rep("a,", 7989) .. "a")
+    assert(not ok and string.find(err, "stack overflow (strsplit())", 1, true))
+    assert(select("#", strsplit(",", string.rep("a,", 3000) .. "a")) == 3001)
+end)
+
+case("strcmputf8i: stops at incomplete sequences ending a string", function()
+    assert(strcmputf8i("\240", "\240") == 0)
+    assert(strcmputf8i("A\224", "a\224") == 0)
+    assert(strcmputf8i("\226\130", "\226\130\172") == -1)
+    assert(strcmputf8i(string.rep("x", 20) .. "\240\159", string.rep("X", 20) .. "\240\159") == 0)
+    assert(strcmputf8i("é\240", "É\240") == strcmputf8i("é", "É"))
+    assert(strcmputf8i("\192\128a", "\192\128b") == 0) -- an overlong zero ends both strings
+end)
@@ -0,0 +1,348 @@
+--
+-- Table extension tests
+--
+
+-- luacheck: globals table.compact table.move table.new table.reserve table.sortstable
+
+case("table.new: creates an empty table", function()
+    local t = table.new(16, 16)
+    assert(type(t) == "table")
+    assert(next(t) == nil)
+    t[1] = true
+    t.key = true
+    assert(t[1] == true and t.key == true)
+end)
+
+case("table.new: rejects negative sizes", function()
+    assert(not pcall(table.new, -1, 0))
+    assert(not pcall(table.new, 0, -1))
+end)
+
+case("table.reserve: returns the table with contents intact", function()
+    local t = { 1, 2, 3, key = "value" }
+    assert(table.reserve(t, 64, 64) == t)
+    assert(#t == 3)
+    assert(t.key == "value")
+end)
+
+case("table.compact: keeps remaining entries", function()
+    local t = {}
+    for i = 1, 1000 do
+        t["k" .. i] = i
+    end
+    for i = 1, 990 do
+        t["k" .. i] = nil
+    end
+    assert(table.compact(t) == t)
+
+    local count = 0
+    for k, v in pairs(t) do
+        assert(t[k] == v and v > 990)
+        count = count + 1
+    end
+    assert(count == 10)
+end)
+
+case("table.sort: sorts numbers and strings without a comparator", function()
+    local numbers = {}
+    local strings = {}
+    for i = 1, 1000 do
+        numbers[i] = (i * 7919) % 1000
+        strings[i] = tostring(numbers[i])
+    end
+    table.sort(numbers)
+    table.sort(strings)
+    for i = 2, 1000 do
+        assert(numbers[i - 1] <= numbers[i])
+        assert(strings[i - 1] <= strings[i])
+    end
+end)
+
+case("table.sort: falls back for mixed and non-sequence values", function()
+    assert(not pcall(table.sort, { 1, "2", 3 }))
+
+    local t = { 3, 1, 2 }
+    t[5] = 0 -- value outside the sequence stays put
+    table.sort(t)
+    assert(t[1] == 1 and t[2] == 2 and t[3] == 3 and t[5] == 0)
+end)
+
+case("table.sort: comparator handles adversarial orderings", function()
+    local n = 10000
+    local t = {}
+    for i = 1, n do
+        t[i] = (i <= n / 2) and i or (n - i)
+    end
+    table.sort(t, function(a, b)
+        return a > b
+    end)
+    for i = 2, n do
+        assert(t[i - 1] >= t[i])
+    end
+end)
+
+case("table.sortstable: keeps equal elements in their original order", function()
+    local t = {}
+    for i = 1, 1000 do
+        t[i] = { key = (i * 7919) % 10, index = i }
+    end
+    table.sortstable(t, function(a, b)
+        return a.key < b.key
+    end)
+    for i = 2, 1000 do
+        local a, b = t[i - 1], t[i]
+        assert(a.key < b.key or (a.key == b.key and a.index < b.index))
+    end
+end)
+
+case("table.sortstable: uses a single pass over sorted input", function()
+    local t = {}
+    for i = 1, 1000 do
+        t[i] = 1001 - i
+    end
+    local calls = 0
+    table.sortstable(t, function(a, b)
+        calls = calls + 1
+        return a < b
+    end)
+    assert(calls == 999)
+    for i = 1, 1000 do
+        assert(t[i] == i)
+    end
+end)
+
+case("table.sortstable: keeps every element when the comparator errors", function()
+    for limit = 1, 2000, 37 do
+        local t = {}
+        for i = 1, 300 do
+            t[i] = (i * 7919) % 300
+        end
+        local calls = 0
+        local ok = pcall(table.sortstable, t, function(a, b)
+            calls = calls + 1
+            if calls == limit then
+                error("comparator failed")
+            end
+            return a < b
+        end)
+        assert(not ok)
+        local seen = {}
+        for i = 1, 300 do
+            assert(t[i] ~= nil and not seen[t[i]])
+            seen[t[i]] = true
+        end
+    end
+end)
+
+case("table.move: handles overlapping ranges in either direction", function()
+    local t = { 1, 2, 3, 4, 5, 6 }
+    assert(table.move(t, 1, 4, 3) == t)
+    assert(table.concat(t, ",") == "1,2,1,2,3,4")
+
+    t = { 1, 2, 3, 4, 5, 6 }
+    table.move(t, 3, 6, 1)
+    assert(table.concat(t, ",") == "3,4,5,6,5,6")
+end)
+
+case("table.move: copies into another table", function()
+    local src = { 1, 2, 3 }
+    local dst = table.move(src, 1, 3, 2, {})
+    assert(dst ~= src)
+    assert(dst[1] == nil and dst[2] == 1 and dst[3] == 2 and dst[4] == 3)
+end)
+
+case("table.move: copies values outside the array part", function()
+    local t = {}
+    for i = 1, 10 do
+        t[i * 100] = i
+    end
+    table.move(t, 100, 1000, 1)
+    assert(t[1] == 1 and t[101] == 2 and t[901] == 10)
+end)
+
+case("length: follows appends and removals at the end of a sequence", function()
+    local t = {}
+    for i = 1, 100 do
+        t[#t + 1] = i
+        assert(#t == i)
+    end
+    for i = 100, 51, -1 do
+        t[#t] = nil
+        assert(#t == i - 1)
+    end
+    table.insert(t, 1, 0)
+    assert(#t == 51 and t[1] == 0 and t[51] == 50)
+    table.wipe(t)
+    assert(#t == 0)
+end)
+
+case("length: matches the search result once the array part has a hole", function()
+    local t = {}
+    for i = 1, 12 do
+        t[i] = i
+    end
+    t[16] = nil -- array part has 16 slots, 12 used
+    assert(#t == 12)
+    t[3] = nil
+    assert(#t == 12)
+    t[14] = 14
+    assert(#t == 14) -- found by the search, not by extending the sequence
+end)
+
+case("next: visits a key stored again after its entry was collected", function()
+    local t = {}
+    local keys = {}
+    for i = 1, 64 do
+        keys[i] = {}
+        t[keys[i]] = i
+    end
+    for i = 1, 64 do
+        t[keys[i]] = nil
+    end
+    collectgarbage()
+    for i = 1, 64 do
+        t[keys[i]] = i
+    end
+    local n = 0
+    for _ in pairs(t) do
+        n = n + 1
+    end
+    assert(n == 64)
+end)
+
+case("table.clone: copies array and hash entries", function()
+    local t = { 1, 2, 3, nil, 5, a = "x", b = { 1 } }
+    local c = table.clone(t)
+    assert(c ~= t and c.b == t.b)
+    assert(c[1] == 1 and c[3] == 3 and c[4] == nil and c[5] == 5 and c.a == "x")
+    c[1] = 10
+    c.a = nil
+    assert(t[1] == 1 and t.a == "x")
+    for i = 6, 100 do
+        c[i] = i
+    end
+    assert(c[100] == 100 and t[100] == nil)
+end)
+
+case("table.clone: does not copy the metatable", function()
+    local t = setmetatable({ 1 }, { __index = function() return 0 end })
+    local c = table.clone(t)
+    assert(getmetatable(c) == nil and c[2] == nil)
+end)
+
+case("table.clone: deep copies preserve shared references and cycles", function()
+    local shared = { 1 }
+    local key = {}
+    local t = { a = shared, b = shared, [key] = { shared } }
+    t.self = t
+    local c = table.clone(t, true)
+    assert(c ~= t and c.self == c)
+    assert(c.a ~= shared and c.a == c.b and c.a[1] == 1)
+    assert(c[key] ~= t[key] and c[key][1] == c.a)
+end)
+
+case("pairs: inlined steps match calls to next", function()
+    local t = { 1, 2, 3, a = "x", b = "y", [2.5] = true }
+    local function collect()
+        local out = {}
+        for k, v in pairs(t) do
+            out[#out + 1] = tostring(k) .. "=" .. tostring(v)
+        end
+        for k in next, t do
+            out[#out + 1] = tostring(k)
+        end
+        return table.concat(out, ",")
+    end
+    local plain = collect()
+    debug.sethook(function() end, "c")
+    local hooked = collect()
+    debug.sethook()
+    assert(plain == hooked)
+end)
+
+case("pairs: inlined steps raise on invalid keys", function()
+    local t = { a = 1 }
+    local ok, err = pcall(function()
+        for k in next, t, "missing" do
+            return k
+        end
+    end)
+    assert(not ok and string.find(err, "invalid key to 'next'", 1, true))
+end)
+
+case("constant keys: lookups stay correct across table layouts", function()
+    local function get(o)
+        return o.x
+    end
+    local function set(o, v)
+        o.x = v
+    end
+    local base = setmetatable({}, { __index = { x = "inherited" } })
+    local tables = {
+        { x = 1, y = 2 },
+        { y = 2, x = 1 },
+        { a = 1, b = 2, c = 3, d = 4, x = 1 },
+        { 1, 2, 3 },
+        base,
+    }
+    for _ = 1, 3 do
+        for i, t in ipairs(tables) do
+            if i <= 3 then
+                assert(get(t) == 1)
+            elseif i == 4 then
+                assert(get(t) == nil)
+            else
+                assert(get(t) == "inherited")
+            end
+        end
+    end
+    set(tables[4], 5)
+    assert(get(tables[4]) == 5 and get(tables[1]) == 1)
+    tables[1].x = nil
+    collectgarbage()
+    assert(get(tables[1]) == nil)
+    set(tables[1], 2)
+    assert(get(tables[1]) == 2 and get(tables[2]) == 1)
+end)
+
+case("string keys: long strings differing in few positions stay distinct", function()
+    local pad = string.rep("x", 200)
+    local t = {}
+    for i = 1, 500 do
+        t[pad .. string.format("%04d", i) .. pad] = i
+    end
+    for i = 1, 500 do
+        assert(t[pad .. string.format("%04d", i) .. pad] == i)
+    end
+    assert(t[pad .. pad] == nil)
+end)
+
+case("table.concat: joins strings and numbers in one pass", function()
+    local t = { "a", 1, 2.5, "", -0.125, "b" }
+    assert(table.concat(t) == "a12.5-0.125b")
+    assert(table.concat(t, ", ") == "a, 1, 2.5, , -0.125, b")
+    assert(table.concat(t, "-", 2, 3) == "1-2.5")
+    assert(table.concat(t, "-", 4, 3) == "")
+    assert(table.concat({ "x\0y", "z" }, "\0") == "x\0y\0z")
+    local h = { [-1] = "m", [0] = "n", [1] = "o" }
+    assert(table.concat(h, "", -1, 1) == "mno")
+    local ok, err = pcall(table.concat, { "a", {}, "c" }, ",")
+    assert(not ok and string.find(err, "invalid value (table) at index 2", 1, true))
+    assert(not pcall(table.concat, { "a" }, ",", 1, 2))
+end)
+
+case("table.wipe: a traversal in progress ends cleanly", function()
+    local t = { 1, 2, 3, a = 1, b = 2, c = 3, [4.5] = true }
+    local visited = 0
+    local lastkey
+    for k in pairs(t) do
+        visited = visited + 1
+        lastkey = k
+        table.wipe(t)
+    end
+    assert(visited == 1 and next(t) == nil)
+    assert(next(t, lastkey) == nil)
+    assert(next(t, "b") == nil and next(t, 4.5) == nil)
+    t.a = 10
+    assert(next(t) == "a" and t.a == 10)
+end)